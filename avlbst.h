@@ -6,13 +6,22 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
 #include "bst.h"
 
 struct KeyError { };
 
 /**
- * A special kind of node for an AVL tree, which adds the balance as a data member.
- * (Do not modify this class.)
+ * A special kind of node for an AVL tree, which adds the balance.  The
+ * balance is kept in the tag bits of the parent pointer (see Node), as a
+ * three-bit two's complement number: rotations briefly hold values up to
+ * +/-3, and an 8-byte-aligned pointer has three free bits.  AVLNode is then
+ * no larger than Node; for 8-byte keys and values, 40 bytes instead of 48.
+ * When AVL_ORDER_STATISTICS is defined it also records the number of nodes
+ * in its subtree, which lets AVLTree answer rank/select queries in O(log n).
  */
 template <typename Key, typename Value>
 class AVLNode : public Node<Key, Value>
@@ -20,20 +29,31 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(ItemFactory<Key, Value>& item, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's balance.
     int8_t getBalance() const;
     void setBalance(int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Overridden getters for parent, left, and right.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+#ifdef AVL_ORDER_STATISTICS
+    // Getter/setter for the number of nodes in this node's subtree.
+    std::size_t getSubtreeSize() const;
+    void setSubtreeSize(std::size_t size);
+#endif
+
+    // Getters for parent, left, and right that hide Node's and return AVLNodes.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
-    int8_t balance_;    // balance factor
+    static const std::uintptr_t BALANCE_SIGN = 4;
+    static_assert(Node<Key, Value>::TAG_MASK >= 7, "AVLNode needs three tag bits in its parent pointer");
+#ifdef AVL_ORDER_STATISTICS
+    uint32_t subtreeSize_;
+#endif
 };
 
 /*-------------------------------------------------
@@ -41,7 +61,18 @@ protected:
 -------------------------------------------------*/
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent)
+#ifdef AVL_ORDER_STATISTICS
+    , subtreeSize_(1)
+#endif
+{ }
+
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(ItemFactory<Key, Value>& item, AVLNode<Key, Value>* parent) :
+    Node<Key, Value>(item, parent)
+#ifdef AVL_ORDER_STATISTICS
+    , subtreeSize_(1)
+#endif
 { }
 
 template<class Key, class Value>
@@ -49,22 +80,35 @@ AVLNode<Key, Value>::~AVLNode() { }
 
 template<class Key, class Value>
 int8_t AVLNode<Key, Value>::getBalance() const {
-    return balance_;
+    std::uintptr_t bits = this->getTag();
+    return static_cast<int8_t>((bits ^ BALANCE_SIGN) - BALANCE_SIGN);
 }
 
 template<class Key, class Value>
 void AVLNode<Key, Value>::setBalance(int8_t balance) {
-    balance_ = balance;
+    this->setTag(static_cast<std::uintptr_t>(balance) & 7);
 }
 
 template<class Key, class Value>
 void AVLNode<Key, Value>::updateBalance(int8_t diff) {
-    balance_ += diff;
+    setBalance(static_cast<int8_t>(getBalance() + diff));
 }
 
+#ifdef AVL_ORDER_STATISTICS
+template<class Key, class Value>
+std::size_t AVLNode<Key, Value>::getSubtreeSize() const {
+    return subtreeSize_;
+}
+
+template<class Key, class Value>
+void AVLNode<Key, Value>::setSubtreeSize(std::size_t size) {
+    subtreeSize_ = static_cast<uint32_t>(size);
+}
+#endif
+
 template<class Key, class Value>
 AVLNode<Key, Value>* AVLNode<Key, Value>::getParent() const {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value>*>(Node<Key, Value>::getParent());
 }
 
 template<class Key, class Value>
@@ -80,167 +124,1016 @@ AVLNode<Key, Value>* AVLNode<Key, Value>::getRight() const {
 /**
  * AVLTree builds on BinarySearchTree. It implements AVL insert and remove.
  */
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Compare = DefaultCompare<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value>& new_item);
+    AVLTree();
+    AVLTree(const AVLTree& other);      // O(n) structural copy, no rebalancing
+    AVLTree(AVLTree&& other);
+    AVLTree& operator=(AVLTree other);
     virtual void remove(const Key& key);
 
+    // Number of keys less than key.
+    std::size_t rank(const Key& key) const;
+    // Iterator to the k-th smallest key (0-based), or end() if k >= size().
+    // Both take O(log n) with AVL_ORDER_STATISTICS and walk the tree otherwise.
+    typename BinarySearchTree<Key, Value, Compare>::iterator select(std::size_t k) const;
+
+    // Appends other, whose keys must all be greater than this tree's, in
+    // O(log n + log m).  Throws std::invalid_argument otherwise.
+    void join(AVLTree& other);
+
+    // Set operations that take over other's nodes and leave it empty.  They
+    // take O(m log(n/m + 1)) work for trees of sizes m <= n, and large inputs
+    // are split across threads.  unite keeps other's value for keys in both
+    // trees, as inserting other's items one by one would.  Compare should
+    // not throw here: an exception from it is passed on once every thread
+    // has finished, but leaves both trees empty, without running the
+    // destructors of the keys and values they held.
+    void unite(AVLTree& other);
+    void intersect(AVLTree& other);
+    void subtract(AVLTree& other);
+
+    // Apply a batch of key/value pairs (or keys) in one pass over the tree
+    // instead of one root-to-leaf walk per item: the batch is sorted and
+    // merged in with the join machinery above.  For repeated keys in an
+    // insert batch the last pair wins, as with one insert per pair.  As with
+    // insert(), a key already in the tree keeps its node, and iterators to
+    // it stay valid; only its value is replaced.  If a node cannot be
+    // allocated, insertBatch throws and leaves the tree as it was.
+    template<typename ForwardIt>
+    void insertBatch(ForwardIt first, ForwardIt last);
+    template<typename ForwardIt>
+    void removeBatch(ForwardIt first, ForwardIt last);
+
 protected:
     // Override nodeSwap so that balance factors are swapped.
-    virtual void nodeSwap(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) override;
+
+    // Every insertion path in BinarySearchTree creates its node here and
+    // hands it to insertFix once linked.
+    virtual Node<Key,Value>* allocateNode(ItemFactory<Key,Value>& item, Node<Key,Value>* parent) override;
 
-    // Helper functions for AVL insertion and removal.
-    AVLNode<Key,Value>* insertHelper(AVLNode<Key,Value>* root, const std::pair<const Key, Value>& new_item, bool &taller);
-    AVLNode<Key,Value>* removeHelper(AVLNode<Key,Value>* root, const Key& key, bool &shorter, bool &success);
+    // Retracing after an insertion or removal.  Both stop as soon as a
+    // subtree's height is unchanged.
+    virtual void insertFix(Node<Key,Value>* node) override;
+    void removeFix(AVLNode<Key,Value>* parent, bool leftShorter);
 
     // Rotation and rebalance helpers.
     AVLNode<Key,Value>* rotateLeft(AVLNode<Key,Value>* root);
     AVLNode<Key,Value>* rotateRight(AVLNode<Key,Value>* root);
     AVLNode<Key,Value>* balanceLeft(AVLNode<Key,Value>* root);
     AVLNode<Key,Value>* balanceRight(AVLNode<Key,Value>* root);
+    AVLNode<Key,Value>* rebalance(AVLNode<Key,Value>* node);
+
+    // Subtree size bookkeeping; no-ops without AVL_ORDER_STATISTICS.
+    static std::size_t subtreeSize(AVLNode<Key,Value>* node);
+    static void updateSubtreeSize(AVLNode<Key,Value>* node);
+    static void adjustSubtreeSizes(AVLNode<Key,Value>* node, int diff);
+
+    // buildFromSorted() support: a subtree of n built nodes is n's bit width high.
+    virtual Node<Key,Value>* createBuiltNode(ItemFactory<Key,Value>& item,
+                                             std::size_t leftCount, std::size_t rightCount,
+                                             int levelsBelow) override;
+    static int builtHeight(std::size_t count);
+
+    // Copies carry the balance factors (and subtree sizes) over.
+    virtual Node<Key,Value>* cloneNode(const Node<Key,Value>* source, Node<Key,Value>* parent) override;
+
+    // Join/split machinery.  A Subtree is a detached AVL subtree (its root
+    // has no parent) together with its height, which the balance factors
+    // alone do not give.
+    struct Subtree {
+         AVLNode<Key,Value>* root;
+         int height;
+    };
+    enum SetOperation { UNITE, INTERSECT, SUBTRACT };
+    // Below this height a set operation does not fork.
+    static const int PARALLEL_MIN_HEIGHT = 12;
 
-    // Helper to recompute height from children (used for balance updates).
-    int calcHeight(AVLNode<Key,Value>* node);
+    static int subtreeHeight(AVLNode<Key,Value>* node);
+    static void childHeights(AVLNode<Key,Value>* node, int height, int& leftHeight, int& rightHeight);
+    static Subtree leftSubtree(AVLNode<Key,Value>* node, int height);
+    static Subtree rightSubtree(AVLNode<Key,Value>* node, int height);
+    static Subtree attach(Subtree left, AVLNode<Key,Value>* mid, Subtree right);
+    Subtree joinTrees(Subtree left, AVLNode<Key,Value>* mid, Subtree right);
+    Subtree joinRight(Subtree left, AVLNode<Key,Value>* mid, Subtree right);
+    Subtree joinLeft(Subtree left, AVLNode<Key,Value>* mid, Subtree right);
+    Subtree joinPair(Subtree left, Subtree right);
+    void splitTree(Subtree tree, const Key& key, Subtree& less, AVLNode<Key,Value>*& match, Subtree& greater);
+    Subtree splitLast(Subtree tree, AVLNode<Key,Value>*& last);
+
+    // Shared driver and recursion for unite/intersect/subtract.  Nodes that
+    // drop out are chained through their left links onto freed and destroyed
+    // once all threads are done, since the pool is not thread-safe; matches
+    // counts keys found in both trees.
+    void setOperation(AVLTree& other, SetOperation op);
+    void destroyFreed(AVLNode<Key,Value>* freed);
+    Subtree setOperationHelper(Subtree a, Subtree b, SetOperation op, int forkDepth,
+                               AVLNode<Key,Value>*& freed, std::size_t& matches);
+    static void freeNode(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& freed);
+    static void freeSubtree(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& freed);
+
+    // Batch support.  Both merges walk down the tree, splitting the sorted
+    // batch at each node's key, and rejoin each node with its rebuilt
+    // subtrees on the way back up; subtrees the batch does not reach are
+    // left untouched.
+    static Subtree buildBatch(AVLNode<Key,Value>** nodes, std::size_t count);
+    Subtree relinkLeft(AVLNode<Key,Value>* node, Subtree left, int rightHeight);
+    Subtree relinkRight(AVLNode<Key,Value>* node, int leftHeight, Subtree right);
+    Subtree insertSorted(Subtree tree, AVLNode<Key,Value>** nodes, std::size_t count,
+                         AVLNode<Key,Value>*& freed, std::size_t& matches);
+    template<typename ForwardIt>
+    Subtree removeSorted(Subtree tree, ForwardIt* keys, std::size_t count,
+                         AVLNode<Key,Value>*& freed, std::size_t& matches);
 };
 
 /*-------------------------------------------------
-  Implementation for AVLTree::insert
+  Implementation for AVLTree constructor
 -------------------------------------------------*/
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value>& new_item)
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), alignof(AVLNode<Key, Value>),
+                                          &BinarySearchTree<Key, Value, Compare>::template destructNode<AVLNode<Key, Value> >)
+{ }
+
+// Copies from the derived constructor so that cloneNode makes AVLNodes.
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree(const AVLTree& other) :
+    AVLTree()
 {
-    bool taller = false;
-    AVLNode<Key,Value>* avlRoot = static_cast<AVLNode<Key,Value>*>(this->root_);
-    avlRoot = insertHelper(avlRoot, new_item, taller);
-    if(avlRoot != nullptr)
-        avlRoot->setParent(nullptr);
-    this->root_ = avlRoot;
+    static_assert(std::is_copy_constructible<Value>::value, "copying a tree needs a copyable Value");
+    this->cloneFrom(other);
 }
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::insertHelper(AVLNode<Key,Value>* root, const std::pair<const Key, Value>& new_item, bool &taller)
-{
-    if(root == nullptr) {
-         taller = true;
-         return new AVLNode<Key,Value>(new_item.first, new_item.second, nullptr);
-    }
-    if(new_item.first < root->getKey()) {
-         AVLNode<Key,Value>* leftChild = insertHelper(static_cast<AVLNode<Key,Value>*>(root->getLeft()), new_item, taller);
-         root->setLeft(leftChild);
-         if(leftChild != nullptr)
-              leftChild->setParent(root);
-         if(taller) {
-              root->updateBalance(1);
-              if(root->getBalance() == 0)
-                   taller = false;
-              else if(root->getBalance() == 2) {
-                   root = balanceLeft(root);
-                   taller = false;
-              }
-         }
-    } else if(new_item.first > root->getKey()) {
-         AVLNode<Key,Value>* rightChild = insertHelper(static_cast<AVLNode<Key,Value>*>(root->getRight()), new_item, taller);
-         root->setRight(rightChild);
-         if(rightChild != nullptr)
-              rightChild->setParent(root);
-         if(taller) {
-              root->updateBalance(-1);
-              if(root->getBalance() == 0)
-                   taller = false;
-              else if(root->getBalance() == -2) {
-                   root = balanceRight(root);
-                   taller = false;
-              }
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree(AVLTree&& other) :
+    BinarySearchTree<Key, Value, Compare>(std::move(other))
+{ }
+
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>& AVLTree<Key, Value, Compare>::operator=(AVLTree other)
+{
+    this->swap(other);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+Node<Key,Value>* AVLTree<Key, Value, Compare>::cloneNode(const Node<Key,Value>* source, Node<Key,Value>* parent)
+{
+    // See BinarySearchTree::cloneNode.
+    if constexpr (std::is_copy_constructible<Value>::value) {
+        const AVLNode<Key,Value>* avlSource = static_cast<const AVLNode<Key,Value>*>(source);
+        ForwardingItemFactory<Key, Value, const std::pair<const Key, Value>&> item(avlSource->getItem());
+        AVLNode<Key,Value>* node = this->template createNode<AVLNode<Key,Value> >(item, static_cast<AVLNode<Key,Value>*>(parent));
+        node->setBalance(avlSource->getBalance());
+#ifdef AVL_ORDER_STATISTICS
+        node->setSubtreeSize(avlSource->getSubtreeSize());
+#endif
+        return node;
+    }
+    else {
+        (void)source;
+        (void)parent;
+        throw std::logic_error("cloneNode: Value is not copy constructible");
+    }
+}
+
+/*-------------------------------------------------
+  Implementation for AVLTree insertion
+  BinarySearchTree finds the slot and links the new leaf; AVLTree supplies
+  the node type and the retracing.
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+Node<Key,Value>* AVLTree<Key, Value, Compare>::allocateNode(ItemFactory<Key,Value>& item, Node<Key,Value>* parent)
+{
+    return this->template createNode<AVLNode<Key,Value> >(item, static_cast<AVLNode<Key,Value>*>(parent));
+}
+
+// Walks up from a freshly linked leaf, adjusting balance factors until a
+// subtree's height stops changing or a rotation restores it.
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::insertFix(Node<Key,Value>* node)
+{
+    AVLNode<Key,Value>* child = static_cast<AVLNode<Key,Value>*>(node);
+    AVLNode<Key,Value>* parent = child->getParent();
+    adjustSubtreeSizes(parent, 1);
+    while(parent != nullptr) {
+         parent->updateBalance(child == parent->getLeft() ? 1 : -1);
+         int8_t bal = parent->getBalance();
+         if(bal == 0)
+              return;
+         if(bal == 2 || bal == -2) {
+              // A rotation after insertion restores the subtree's old height.
+              rebalance(parent);
+              return;
          }
-    } else {
-         // Key already exists: update value.
-         root->setValue(new_item.second);
-         taller = false;
+         child = parent;
+         parent = parent->getParent();
     }
-    return root;
 }
 
 /*-------------------------------------------------
   Implementation for AVLTree::remove
 -------------------------------------------------*/
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::remove(const Key& key)
 {
-    bool shorter = false;
-    bool success = false;
-    AVLNode<Key,Value>* avlRoot = static_cast<AVLNode<Key,Value>*>(this->root_);
-    avlRoot = removeHelper(avlRoot, key, shorter, success);
-    if(avlRoot != nullptr)
-         avlRoot->setParent(nullptr);
-    this->root_ = avlRoot;
+    AVLNode<Key,Value>* node = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
+    if(node == nullptr)
+         return;
+
+    // Node with two children: swap with its predecessor so that it has at most one.
+    if(node->getLeft() != nullptr && node->getRight() != nullptr) {
+         AVLNode<Key,Value>* pred = static_cast<AVLNode<Key,Value>*>(BinarySearchTree<Key, Value, Compare>::predecessor(node));
+         nodeSwap(node, pred);
+    }
+
+    AVLNode<Key,Value>* child = (node->getLeft() != nullptr) ? node->getLeft() : node->getRight();
+    AVLNode<Key,Value>* parent = node->getParent();
+    bool wasLeft = (parent != nullptr && parent->getLeft() == node);
+    if(child != nullptr)
+         child->setParent(parent);
+    if(parent == nullptr)
+         this->root_ = child;
+    else if(wasLeft)
+         parent->setLeft(child);
+    else
+         parent->setRight(child);
+    this->destroyNode(node);
+    --this->size_;
+
+    adjustSubtreeSizes(parent, -1);
+    removeFix(parent, wasLeft);
 }
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::removeHelper(AVLNode<Key,Value>* root, const Key& key, bool &shorter, bool &success)
+// Walks up from the parent of a removed node whose left (or right) subtree
+// just got shorter, stopping once a subtree keeps its height.
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::removeFix(AVLNode<Key,Value>* parent, bool leftShorter)
 {
-    if(root == nullptr) {
-         shorter = false;
-         success = false;
-         return nullptr;
-    }
-    if(key < root->getKey()) {
-         root->setLeft(removeHelper(static_cast<AVLNode<Key,Value>*>(root->getLeft()), key, shorter, success));
-         if(root->getLeft() != nullptr)
-              root->getLeft()->setParent(root);
-         if(shorter)
-              root->updateBalance(-1);
-    } else if(key > root->getKey()) {
-         root->setRight(removeHelper(static_cast<AVLNode<Key,Value>*>(root->getRight()), key, shorter, success));
-         if(root->getRight() != nullptr)
-              root->getRight()->setParent(root);
-         if(shorter)
-              root->updateBalance(1);
-    } else {
-         // Node found.
-         success = true;
-         if(root->getLeft() == nullptr || root->getRight() == nullptr) {
-              AVLNode<Key,Value>* temp = (root->getLeft() != nullptr) ?
-                    static_cast<AVLNode<Key,Value>*>(root->getLeft()) :
-                    static_cast<AVLNode<Key,Value>*>(root->getRight());
-              delete root;
-              shorter = true;
-              return temp;
-         } else {
-              // Node with two children.
-              AVLNode<Key,Value>* pred = static_cast<AVLNode<Key,Value>*>(BinarySearchTree<Key,Value>::predecessor(root));
-              this->nodeSwap(root, pred);
-              // After swap, update the local pointer to the predecessor (which now occupies the removed node's position)
-              root = pred;
-              root->setLeft(removeHelper(root->getLeft(), key, shorter, success));
-              if(root->getLeft() != nullptr)
-                  root->getLeft()->setParent(root);
-              if(shorter)
-                  root->updateBalance(-1);
+    while(parent != nullptr) {
+         parent->updateBalance(leftShorter ? -1 : 1);
+         int8_t bal = parent->getBalance();
+         if(bal == 1 || bal == -1)
+              return;
+         AVLNode<Key,Value>* subtree = parent;
+         if(bal == 2 || bal == -2) {
+              subtree = rebalance(parent);
+              // A rotation that leaves the new root tilted kept the old height.
+              if(subtree->getBalance() != 0)
+                   return;
          }
+         parent = subtree->getParent();
+         if(parent != nullptr)
+              leftShorter = (parent->getLeft() == subtree);
     }
-    int bal = root->getBalance();
-    if(bal == 2) {
-         root = balanceLeft(root);
-         shorter = false;
-    } else if(bal == -2) {
-         root = balanceRight(root);
-         shorter = false;
-    } else {
-         if(bal == 0)
-              shorter = true;
+}
+
+/*-------------------------------------------------
+  Order statistics: rank and select
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+std::size_t AVLTree<Key, Value, Compare>::rank(const Key& key) const
+{
+    std::size_t count = 0;
+#ifdef AVL_ORDER_STATISTICS
+    AVLNode<Key,Value>* current = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while(current != nullptr) {
+         if(this->compare_(current->getKey(), key) < 0) {
+              count += subtreeSize(current->getLeft()) + 1;
+              current = current->getRight();
+         }
          else
-              shorter = false;
+              current = current->getLeft();
+    }
+#else
+    for(typename BinarySearchTree<Key, Value, Compare>::iterator it = this->begin();
+        it != this->end() && this->compare_(it->first, key) < 0; ++it)
+         ++count;
+#endif
+    return count;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator AVLTree<Key, Value, Compare>::select(std::size_t k) const
+{
+    if(k >= this->size_)
+         return this->end();
+#ifdef AVL_ORDER_STATISTICS
+    AVLNode<Key,Value>* current = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while(current != nullptr) {
+         std::size_t leftSize = subtreeSize(current->getLeft());
+         if(k < leftSize)
+              current = current->getLeft();
+         else if(k == leftSize)
+              break;
+         else {
+              k -= leftSize + 1;
+              current = current->getRight();
+         }
+    }
+    return typename BinarySearchTree<Key, Value, Compare>::iterator(current);
+#else
+    typename BinarySearchTree<Key, Value, Compare>::iterator it = this->begin();
+    for(; k > 0; --k)
+         ++it;
+    return it;
+#endif
+}
+
+template<class Key, class Value, class Compare>
+std::size_t AVLTree<Key, Value, Compare>::subtreeSize(AVLNode<Key,Value>* node)
+{
+#ifdef AVL_ORDER_STATISTICS
+    return (node == nullptr) ? 0 : node->getSubtreeSize();
+#else
+    return 0;
+#endif
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::updateSubtreeSize(AVLNode<Key,Value>* node)
+{
+#ifdef AVL_ORDER_STATISTICS
+    node->setSubtreeSize(1 + subtreeSize(node->getLeft()) + subtreeSize(node->getRight()));
+#endif
+}
+
+// Adds diff to the subtree size of node and every ancestor.
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::adjustSubtreeSizes(AVLNode<Key,Value>* node, int diff)
+{
+#ifdef AVL_ORDER_STATISTICS
+    for(; node != nullptr; node = node->getParent())
+         node->setSubtreeSize(node->getSubtreeSize() + diff);
+#endif
+}
+
+/*-------------------------------------------------
+  Bulk construction support
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+Node<Key,Value>* AVLTree<Key, Value, Compare>::createBuiltNode(ItemFactory<Key,Value>& item,
+                                                      std::size_t leftCount, std::size_t rightCount, int)
+{
+    AVLNode<Key,Value>* node = this->template createNode<AVLNode<Key,Value> >(item, nullptr);
+    node->setBalance(static_cast<int8_t>(builtHeight(leftCount) - builtHeight(rightCount)));
+#ifdef AVL_ORDER_STATISTICS
+    node->setSubtreeSize(leftCount + rightCount + 1);
+#endif
+    return node;
+}
+
+template<class Key, class Value, class Compare>
+int AVLTree<Key, Value, Compare>::builtHeight(std::size_t count)
+{
+    int height = 0;
+    for(; count != 0; count >>= 1)
+         ++height;
+    return height;
+}
+
+/*-------------------------------------------------
+  Join and split
+  All of these work on detached subtrees and keep their balance factors,
+  subtree sizes and parent links valid.
+-------------------------------------------------*/
+// Follows the taller side down to a leaf.
+template<class Key, class Value, class Compare>
+int AVLTree<Key, Value, Compare>::subtreeHeight(AVLNode<Key,Value>* node)
+{
+    int height = 0;
+    while(node != nullptr) {
+         ++height;
+         node = (node->getBalance() > 0) ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::childHeights(AVLNode<Key,Value>* node, int height, int& leftHeight, int& rightHeight)
+{
+    int bal = node->getBalance();
+    leftHeight = (bal >= 0) ? height - 1 : height - 1 + bal;
+    rightHeight = (bal <= 0) ? height - 1 : height - 1 - bal;
+}
+
+// Detaches node's left (or right) subtree.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree AVLTree<Key, Value, Compare>::leftSubtree(AVLNode<Key,Value>* node, int height)
+{
+    int leftHeight, rightHeight;
+    childHeights(node, height, leftHeight, rightHeight);
+    Subtree left = { node->getLeft(), leftHeight };
+    if(left.root != nullptr)
+         left.root->setParent(nullptr);
+    node->setLeft(nullptr);
+    return left;
+}
+
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree AVLTree<Key, Value, Compare>::rightSubtree(AVLNode<Key,Value>* node, int height)
+{
+    int leftHeight, rightHeight;
+    childHeights(node, height, leftHeight, rightHeight);
+    Subtree right = { node->getRight(), rightHeight };
+    if(right.root != nullptr)
+         right.root->setParent(nullptr);
+    node->setRight(nullptr);
+    return right;
+}
+
+// Hangs left and right (heights within one of each other) under mid.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::attach(Subtree left, AVLNode<Key,Value>* mid, Subtree right)
+{
+    mid->setParent(nullptr);
+    mid->setLeft(left.root);
+    mid->setRight(right.root);
+    if(left.root != nullptr)
+         left.root->setParent(mid);
+    if(right.root != nullptr)
+         right.root->setParent(mid);
+    mid->setBalance(static_cast<int8_t>(left.height - right.height));
+    updateSubtreeSize(mid);
+    Subtree joined = { mid, std::max(left.height, right.height) + 1 };
+    return joined;
+}
+
+// Joins left, mid and right, where every key in left is less than mid's and
+// every key in right is greater, in O(|left.height - right.height| + 1).
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::joinTrees(Subtree left, AVLNode<Key,Value>* mid, Subtree right)
+{
+    if(left.height > right.height + 1)
+         return joinRight(left, mid, right);
+    if(right.height > left.height + 1)
+         return joinLeft(left, mid, right);
+    return attach(left, mid, right);
+}
+
+// left is the taller tree: walk down its right spine to a subtree no more
+// than one taller than right, put mid there, and rebalance on the way back.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::joinRight(Subtree left, AVLNode<Key,Value>* mid, Subtree right)
+{
+    AVLNode<Key,Value>* root = left.root;
+    int leftHeight, spineHeight;
+    childHeights(root, left.height, leftHeight, spineHeight);
+    Subtree spine = rightSubtree(root, left.height);
+    Subtree grown = (spine.height <= right.height + 1) ? attach(spine, mid, right)
+                                                       : joinRight(spine, mid, right);
+    root->setRight(grown.root);
+    grown.root->setParent(root);
+    root->setBalance(static_cast<int8_t>(leftHeight - grown.height));
+    updateSubtreeSize(root);
+    Subtree joined = { root, std::max(leftHeight, grown.height) + 1 };
+    if(grown.height <= leftHeight + 1)
+         return joined;
+
+    // The right side is now two taller: rotate as balanceRight would, with
+    // the new heights worked out from the old ones.
+    int innerHeight, outerHeight;
+    childHeights(grown.root, grown.height, innerHeight, outerHeight);
+    if(grown.root->getBalance() <= 0) {
+         int rootHeight = std::max(leftHeight, innerHeight) + 1;
+         joined.root = rotateLeft(root);
+         joined.height = std::max(rootHeight, outerHeight) + 1;
+    }
+    else {
+         int innerLeft, innerRight;
+         childHeights(grown.root->getLeft(), innerHeight, innerLeft, innerRight);
+         int rootHeight = std::max(leftHeight, innerLeft) + 1;
+         int grownHeight = std::max(innerRight, outerHeight) + 1;
+         root->setRight(rotateRight(grown.root));
+         root->getRight()->setParent(root);
+         joined.root = rotateLeft(root);
+         joined.height = std::max(rootHeight, grownHeight) + 1;
+    }
+    joined.root->setParent(nullptr);
+    return joined;
+}
+
+// Mirror image of joinRight.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::joinLeft(Subtree left, AVLNode<Key,Value>* mid, Subtree right)
+{
+    AVLNode<Key,Value>* root = right.root;
+    int spineHeight, rightHeight;
+    childHeights(root, right.height, spineHeight, rightHeight);
+    Subtree spine = leftSubtree(root, right.height);
+    Subtree grown = (spine.height <= left.height + 1) ? attach(left, mid, spine)
+                                                      : joinLeft(left, mid, spine);
+    root->setLeft(grown.root);
+    grown.root->setParent(root);
+    root->setBalance(static_cast<int8_t>(grown.height - rightHeight));
+    updateSubtreeSize(root);
+    Subtree joined = { root, std::max(rightHeight, grown.height) + 1 };
+    if(grown.height <= rightHeight + 1)
+         return joined;
+
+    int outerHeight, innerHeight;
+    childHeights(grown.root, grown.height, outerHeight, innerHeight);
+    if(grown.root->getBalance() >= 0) {
+         int rootHeight = std::max(rightHeight, innerHeight) + 1;
+         joined.root = rotateRight(root);
+         joined.height = std::max(rootHeight, outerHeight) + 1;
+    }
+    else {
+         int innerLeft, innerRight;
+         childHeights(grown.root->getRight(), innerHeight, innerLeft, innerRight);
+         int rootHeight = std::max(rightHeight, innerRight) + 1;
+         int grownHeight = std::max(innerLeft, outerHeight) + 1;
+         root->setLeft(rotateLeft(grown.root));
+         root->getLeft()->setParent(root);
+         joined.root = rotateRight(root);
+         joined.height = std::max(rootHeight, grownHeight) + 1;
+    }
+    joined.root->setParent(nullptr);
+    return joined;
+}
+
+// Joins two subtrees with no key between them, using left's largest node
+// as the middle.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree AVLTree<Key, Value, Compare>::joinPair(Subtree left, Subtree right)
+{
+    if(left.root == nullptr)
+         return right;
+    AVLNode<Key,Value>* last = nullptr;
+    Subtree rest = splitLast(left, last);
+    return joinTrees(rest, last, right);
+}
+
+// Splits tree into the keys less than key and those greater.  A node
+// holding key itself comes back detached in match (nullptr if none).
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::splitTree(Subtree tree, const Key& key, Subtree& less,
+                                    AVLNode<Key,Value>*& match, Subtree& greater)
+{
+    if(tree.root == nullptr) {
+         less = greater = tree;
+         match = nullptr;
+         return;
+    }
+    AVLNode<Key,Value>* node = tree.root;
+    Subtree left = leftSubtree(node, tree.height);
+    Subtree right = rightSubtree(node, tree.height);
+    int order = this->compare_(key, node->getKey());
+    if(order < 0) {
+         Subtree middle;
+         splitTree(left, key, less, match, middle);
+         greater = joinTrees(middle, node, right);
+    }
+    else if(order > 0) {
+         Subtree middle;
+         splitTree(right, key, middle, match, greater);
+         less = joinTrees(left, node, middle);
+    }
+    else {
+         less = left;
+         greater = right;
+         match = node;
+         node->setBalance(0);
+         updateSubtreeSize(node);
+    }
+}
+
+// Removes the largest node of a non-empty tree, returned in last.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree AVLTree<Key, Value, Compare>::splitLast(Subtree tree, AVLNode<Key,Value>*& last)
+{
+    AVLNode<Key,Value>* node = tree.root;
+    Subtree left = leftSubtree(node, tree.height);
+    Subtree right = rightSubtree(node, tree.height);
+    if(right.root == nullptr) {
+         last = node;
+         node->setBalance(0);
+         updateSubtreeSize(node);
+         return left;
+    }
+    Subtree rest = splitLast(right, last);
+    return joinTrees(left, node, rest);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::join(AVLTree& other)
+{
+    if(&other == this || other.root_ == nullptr)
+         return;
+    if(this->root_ != nullptr) {
+         if(this->compare_(this->getLargestNode()->getKey(), other.getSmallestNode()->getKey()) >= 0)
+              throw std::invalid_argument("join: keys of other must follow this tree's");
+    }
+    this->pool_.splice(other.pool_);
+    Subtree left = { static_cast<AVLNode<Key,Value>*>(this->root_), subtreeHeight(static_cast<AVLNode<Key,Value>*>(this->root_)) };
+    Subtree right = { static_cast<AVLNode<Key,Value>*>(other.root_), subtreeHeight(static_cast<AVLNode<Key,Value>*>(other.root_)) };
+    this->root_ = joinPair(left, right).root;
+    this->size_ += other.size_;
+    this->rightmost_ = other.rightmost_;
+    other.root_ = nullptr;
+    other.size_ = 0;
+    other.rightmost_ = nullptr;
+}
+
+/*-------------------------------------------------
+  Set operations
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::unite(AVLTree& other)
+{
+    setOperation(other, UNITE);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::intersect(AVLTree& other)
+{
+    setOperation(other, INTERSECT);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::subtract(AVLTree& other)
+{
+    setOperation(other, SUBTRACT);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::setOperation(AVLTree& other, SetOperation op)
+{
+    if(&other == this) {
+         if(op == SUBTRACT)
+              this->clear();
+         return;
+    }
+    // Fork about log2(cores) levels deep, so there is about one leaf task
+    // per hardware thread.
+    int forkDepth = 0;
+    for(unsigned threads = std::thread::hardware_concurrency(); threads > 1; threads = (threads + 1) / 2)
+         ++forkDepth;
+
+    this->pool_.splice(other.pool_);
+    AVLNode<Key,Value>* a = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* b = static_cast<AVLNode<Key,Value>*>(other.root_);
+    Subtree left = { a, subtreeHeight(a) };
+    Subtree right = { b, subtreeHeight(b) };
+    std::size_t sizeA = this->size_;
+    std::size_t sizeB = other.size_;
+    other.root_ = nullptr;
+    other.size_ = 0;
+    other.rightmost_ = nullptr;
+    this->rightmost_ = nullptr;
+
+    AVLNode<Key,Value>* freed = nullptr;
+    std::size_t matches = 0;
+    try {
+         this->root_ = setOperationHelper(left, right, op, forkDepth, freed, matches).root;
+    }
+    catch(...) {
+         // The nodes are spread over half-finished pieces that cannot be
+         // put back together; see the comment on unite().
+         this->root_ = nullptr;
+         this->size_ = 0;
+         throw;
+    }
+    if(op == UNITE)
+         this->size_ = sizeA + sizeB - matches;
+    else if(op == INTERSECT)
+         this->size_ = matches;
+    else
+         this->size_ = sizeA - matches;
+    destroyFreed(freed);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::destroyFreed(AVLNode<Key,Value>* freed)
+{
+    while(freed != nullptr) {
+         AVLNode<Key,Value>* next = freed->getLeft();
+         this->destroyNode(freed);
+         freed = next;
+    }
+}
+
+// Splits a around b's root, recurses on the two halves (in parallel when
+// they are big enough), and joins the results back around b's root, a's
+// matching node, or nothing, depending on op.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::setOperationHelper(Subtree a, Subtree b, SetOperation op, int forkDepth,
+                                        AVLNode<Key,Value>*& freed, std::size_t& matches)
+{
+    if(b.root == nullptr) {
+         if(op != INTERSECT)
+              return a;
+         freeSubtree(a.root, freed);
+         Subtree empty = { nullptr, 0 };
+         return empty;
+    }
+    if(a.root == nullptr) {
+         if(op == UNITE)
+              return b;
+         freeSubtree(b.root, freed);
+         return a;
+    }
+
+    AVLNode<Key,Value>* pivot = b.root;
+    Subtree bLeft = leftSubtree(pivot, b.height);
+    Subtree bRight = rightSubtree(pivot, b.height);
+    Subtree aLeft, aRight;
+    AVLNode<Key,Value>* match = nullptr;
+    splitTree(a, pivot->getKey(), aLeft, match, aRight);
+    if(match != nullptr)
+         ++matches;
+
+    Subtree left, right;
+    bool forked = false;
+    if(forkDepth > 0 && b.height >= PARALLEL_MIN_HEIGHT) {
+         // The worker gets its own freed list and match count, merged in
+         // once it has been joined.
+         AVLNode<Key,Value>* freedRight = nullptr;
+         std::size_t matchesRight = 0;
+         std::exception_ptr workerError;
+         std::thread worker;
+         try {
+              worker = std::thread([&]() {
+                   try {
+                        right = setOperationHelper(aRight, bRight, op, forkDepth - 1, freedRight, matchesRight);
+                   }
+                   catch(...) {
+                        workerError = std::current_exception();
+                   }
+              });
+         }
+         catch(const std::system_error&) {
+              // No thread to be had: run this level sequentially.
+         }
+         if(worker.joinable()) {
+              // The worker is joined on every path, and what it threw is
+              // passed on from here.
+              try {
+                   left = setOperationHelper(aLeft, bLeft, op, forkDepth - 1, freed, matches);
+              }
+              catch(...) {
+                   worker.join();
+                   throw;
+              }
+              worker.join();
+              if(workerError)
+                   std::rethrow_exception(workerError);
+              forked = true;
+              matches += matchesRight;
+              while(freedRight != nullptr) {
+                   AVLNode<Key,Value>* next = freedRight->getLeft();
+                   freeNode(freedRight, freed);
+                   freedRight = next;
+              }
+         }
     }
-    return root;
+    if(!forked) {
+         left = setOperationHelper(aLeft, bLeft, op, 0, freed, matches);
+         right = setOperationHelper(aRight, bRight, op, 0, freed, matches);
+    }
+
+    if(op == UNITE) {
+         if(match != nullptr)
+              freeNode(match, freed);
+         return joinTrees(left, pivot, right);
+    }
+    freeNode(pivot, freed);
+    if(op == INTERSECT && match != nullptr)
+         return joinTrees(left, match, right);
+    if(match != nullptr)
+         freeNode(match, freed);
+    return joinPair(left, right);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::freeNode(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& freed)
+{
+    node->setLeft(freed);
+    freed = node;
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::freeSubtree(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& freed)
+{
+    if(node == nullptr)
+         return;
+    freeSubtree(node->getLeft(), freed);
+    freeSubtree(node->getRight(), freed);
+    freeNode(node, freed);
+}
+
+/*-------------------------------------------------
+  Batch insert and remove
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare>::insertBatch(ForwardIt first, ForwardIt last)
+{
+    // Sort positions rather than copies of the pairs; the stable sort keeps
+    // repeated keys in batch order, so the last one can be kept.
+    std::vector<ForwardIt> sorted;
+    for(; first != last; ++first)
+         sorted.push_back(first);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [this](const ForwardIt& lhs, const ForwardIt& rhs) { return this->compare_(lhs->first, rhs->first) < 0; });
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < sorted.size(); ++i) {
+         if(i + 1 < sorted.size() && this->compare_(sorted[i]->first, sorted[i + 1]->first) == 0)
+              continue;
+         sorted[count++] = sorted[i];
+    }
+
+    // Every node is made before the tree is touched, so merging runs no user
+    // code besides comparisons.  A key already in the tree keeps its node;
+    // the batch node's value is moved into it afterwards.
+    std::vector<AVLNode<Key,Value>*> nodes;
+    nodes.reserve(count);
+    try {
+         for(std::size_t i = 0; i < count; ++i) {
+              ForwardingItemFactory<Key, Value, const typename std::iterator_traits<ForwardIt>::value_type&> item(*sorted[i]);
+              nodes.push_back(this->template createNode<AVLNode<Key,Value> >(item, nullptr));
+         }
+    }
+    catch(...) {
+         for(std::size_t i = 0; i < nodes.size(); ++i)
+              this->destroyNode(nodes[i]);
+         throw;
+    }
+    AVLNode<Key,Value>* root = static_cast<AVLNode<Key,Value>*>(this->root_);
+    Subtree tree = { root, subtreeHeight(root) };
+    AVLNode<Key,Value>* freed = nullptr;
+    std::size_t matches = 0;
+    this->root_ = insertSorted(tree, nodes.data(), count, freed, matches).root;
+    this->rightmost_ = nullptr;
+    this->size_ += count - matches;
+    for(AVLNode<Key,Value>* node = freed; node != nullptr; node = node->getLeft())
+         node->getParent()->setValue(std::move(node->getValue()));
+    destroyFreed(freed);
+}
+
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare>::removeBatch(ForwardIt first, ForwardIt last)
+{
+    std::vector<ForwardIt> sorted;
+    for(; first != last; ++first)
+         sorted.push_back(first);
+    std::sort(sorted.begin(), sorted.end(),
+              [this](const ForwardIt& lhs, const ForwardIt& rhs) { return this->compare_(*lhs, *rhs) < 0; });
+
+    AVLNode<Key,Value>* root = static_cast<AVLNode<Key,Value>*>(this->root_);
+    Subtree tree = { root, subtreeHeight(root) };
+    AVLNode<Key,Value>* freed = nullptr;
+    std::size_t matches = 0;
+    this->root_ = removeSorted(tree, sorted.data(), sorted.size(), freed, matches).root;
+    this->size_ -= matches;
+    destroyFreed(freed);
+}
+
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree AVLTree<Key, Value, Compare>::buildBatch(AVLNode<Key,Value>** nodes, std::size_t count)
+{
+    if(count == 0) {
+         Subtree empty = { nullptr, 0 };
+         return empty;
+    }
+    std::size_t mid = count / 2;
+    Subtree left = buildBatch(nodes, mid);
+    Subtree right = buildBatch(nodes + mid + 1, count - mid - 1);
+    return attach(left, nodes[mid], right);
+}
+
+// Puts a rebuilt right (or left) subtree back under node.  While the heights
+// still fit, the other child stays linked and is not even read; otherwise
+// node is rejoined with both.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::relinkRight(AVLNode<Key,Value>* node, int leftHeight, Subtree right)
+{
+    if(right.height > leftHeight + 1 || right.height < leftHeight - 1) {
+         Subtree left = { node->getLeft(), leftHeight };
+         if(left.root != nullptr)
+              left.root->setParent(nullptr);
+         node->setLeft(nullptr);
+         return joinTrees(left, node, right);
+    }
+    node->setRight(right.root);
+    if(right.root != nullptr)
+         right.root->setParent(node);
+    node->setBalance(static_cast<int8_t>(leftHeight - right.height));
+    updateSubtreeSize(node);
+    Subtree joined = { node, std::max(leftHeight, right.height) + 1 };
+    return joined;
+}
+
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::relinkLeft(AVLNode<Key,Value>* node, Subtree left, int rightHeight)
+{
+    if(left.height > rightHeight + 1 || left.height < rightHeight - 1) {
+         Subtree right = { node->getRight(), rightHeight };
+         if(right.root != nullptr)
+              right.root->setParent(nullptr);
+         node->setRight(nullptr);
+         return joinTrees(left, node, right);
+    }
+    node->setLeft(left.root);
+    if(left.root != nullptr)
+         left.root->setParent(node);
+    node->setBalance(static_cast<int8_t>(left.height - rightHeight));
+    updateSubtreeSize(node);
+    Subtree joined = { node, std::max(left.height, rightHeight) + 1 };
+    return joined;
+}
+
+// A batch node whose key is already in the tree is left out of it and put
+// on freed, its parent link pointing at the tree's node for the key.
+template<class Key, class Value, class Compare>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::insertSorted(Subtree tree, AVLNode<Key,Value>** nodes, std::size_t count,
+                                  AVLNode<Key,Value>*& freed, std::size_t& matches)
+{
+    if(count == 0)
+         return tree;
+    if(tree.root == nullptr)
+         return buildBatch(nodes, count);
+    AVLNode<Key,Value>* node = tree.root;
+    const Key& key = node->getKey();
+    std::size_t split = std::lower_bound(nodes, nodes + count, key,
+         [this](AVLNode<Key,Value>* lhs, const Key& rhs) { return this->compare_(lhs->getKey(), rhs) < 0; }) - nodes;
+    std::size_t after = split;
+    if(split < count && this->compare_(key, nodes[split]->getKey()) == 0) {
+         nodes[split]->setParent(node);
+         freeNode(nodes[split], freed);
+         after = split + 1;
+         ++matches;
+    }
+    int leftHeight, rightHeight;
+    childHeights(node, tree.height, leftHeight, rightHeight);
+    if(split == 0)
+         return relinkRight(node, leftHeight,
+                            insertSorted(rightSubtree(node, tree.height), nodes + after, count - after, freed, matches));
+    if(after == count)
+         return relinkLeft(node, insertSorted(leftSubtree(node, tree.height), nodes, split, freed, matches),
+                           rightHeight);
+
+    Subtree left = leftSubtree(node, tree.height);
+    Subtree right = rightSubtree(node, tree.height);
+    left = insertSorted(left, nodes, split, freed, matches);
+    right = insertSorted(right, nodes + after, count - after, freed, matches);
+    return joinTrees(left, node, right);
+}
+
+// Repeated keys are harmless: once the first copy has removed the node,
+// the rest find nothing.
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+typename AVLTree<Key, Value, Compare>::Subtree
+AVLTree<Key, Value, Compare>::removeSorted(Subtree tree, ForwardIt* keys, std::size_t count,
+                                  AVLNode<Key,Value>*& freed, std::size_t& matches)
+{
+    if(tree.root == nullptr || count == 0)
+         return tree;
+    AVLNode<Key,Value>* node = tree.root;
+    const Key& key = node->getKey();
+    std::size_t split = std::lower_bound(keys, keys + count, key,
+         [this](const ForwardIt& lhs, const Key& rhs) { return this->compare_(*lhs, rhs) < 0; }) - keys;
+    std::size_t after = split;
+    while(after < count && this->compare_(key, *keys[after]) == 0)
+         ++after;
+    int leftHeight, rightHeight;
+    childHeights(node, tree.height, leftHeight, rightHeight);
+    if(after == split && split == 0)
+         return relinkRight(node, leftHeight,
+                            removeSorted(rightSubtree(node, tree.height), keys, count, freed, matches));
+    if(after == split && after == count)
+         return relinkLeft(node, removeSorted(leftSubtree(node, tree.height), keys, count, freed, matches),
+                           rightHeight);
+
+    Subtree left = leftSubtree(node, tree.height);
+    Subtree right = rightSubtree(node, tree.height);
+    left = removeSorted(left, keys, split, freed, matches);
+    right = removeSorted(right, keys + after, count - after, freed, matches);
+    if(after == split)
+         return joinTrees(left, node, right);
+    freeNode(node, freed);
+    ++matches;
+    return joinPair(left, right);
 }
 
 /*-------------------------------------------------
   Rotation and Rebalance Helper Functions
 -------------------------------------------------*/
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::rotateRight(AVLNode<Key,Value>* root)
+template<class Key, class Value, class Compare>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare>::rotateRight(AVLNode<Key,Value>* root)
 {
     AVLNode<Key,Value>* leftChild = static_cast<AVLNode<Key,Value>*>(root->getLeft());
     root->setLeft(leftChild->getRight());
@@ -250,15 +1143,19 @@ AVLNode<Key,Value>* AVLTree<Key,Value>::rotateRight(AVLNode<Key,Value>* root)
     leftChild->setParent(root->getParent());
     root->setParent(leftChild);
 
-    root->setBalance(calcHeight(static_cast<AVLNode<Key,Value>*>(root->getLeft())) -
-                     calcHeight(static_cast<AVLNode<Key,Value>*>(root->getRight())));
-    leftChild->setBalance(calcHeight(static_cast<AVLNode<Key,Value>*>(leftChild->getLeft())) -
-                          calcHeight(static_cast<AVLNode<Key,Value>*>(leftChild->getRight())));
+    // Balance factors follow from the old ones (balance = left height - right height),
+    // so no subtree needs to be re-measured.
+    int8_t rootBal = root->getBalance() - 1 - std::max<int8_t>(leftChild->getBalance(), 0);
+    int8_t childBal = leftChild->getBalance() - 1 + std::min<int8_t>(rootBal, 0);
+    root->setBalance(rootBal);
+    leftChild->setBalance(childBal);
+    updateSubtreeSize(root);
+    updateSubtreeSize(leftChild);
     return leftChild;
 }
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::rotateLeft(AVLNode<Key,Value>* root)
+template<class Key, class Value, class Compare>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare>::rotateLeft(AVLNode<Key,Value>* root)
 {
     AVLNode<Key,Value>* rightChild = static_cast<AVLNode<Key,Value>*>(root->getRight());
     root->setRight(rightChild->getLeft());
@@ -268,20 +1165,25 @@ AVLNode<Key,Value>* AVLTree<Key,Value>::rotateLeft(AVLNode<Key,Value>* root)
     rightChild->setParent(root->getParent());
     root->setParent(rightChild);
 
-    root->setBalance(calcHeight(static_cast<AVLNode<Key,Value>*>(root->getLeft())) -
-                     calcHeight(static_cast<AVLNode<Key,Value>*>(root->getRight())));
-    rightChild->setBalance(calcHeight(static_cast<AVLNode<Key,Value>*>(rightChild->getLeft())) -
-                           calcHeight(static_cast<AVLNode<Key,Value>*>(rightChild->getRight())));
+    // Mirror image of rotateRight.
+    int8_t rootBal = root->getBalance() + 1 - std::min<int8_t>(rightChild->getBalance(), 0);
+    int8_t childBal = rightChild->getBalance() + 1 + std::max<int8_t>(rootBal, 0);
+    root->setBalance(rootBal);
+    rightChild->setBalance(childBal);
+    updateSubtreeSize(root);
+    updateSubtreeSize(rightChild);
     return rightChild;
 }
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::balanceLeft(AVLNode<Key,Value>* root)
+template<class Key, class Value, class Compare>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare>::balanceLeft(AVLNode<Key,Value>* root)
 {
     AVLNode<Key,Value>* leftChild = static_cast<AVLNode<Key,Value>*>(root->getLeft());
     if(leftChild->getBalance() >= 0) {
+         this->recordRotation(false);
          return rotateRight(root);
     } else {
+         this->recordRotation(true);
          root->setLeft(rotateLeft(leftChild));
          if(root->getLeft() != nullptr)
               root->getLeft()->setParent(root);
@@ -289,13 +1191,15 @@ AVLNode<Key,Value>* AVLTree<Key,Value>::balanceLeft(AVLNode<Key,Value>* root)
     }
 }
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key,Value>::balanceRight(AVLNode<Key,Value>* root)
+template<class Key, class Value, class Compare>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare>::balanceRight(AVLNode<Key,Value>* root)
 {
     AVLNode<Key,Value>* rightChild = static_cast<AVLNode<Key,Value>*>(root->getRight());
     if(rightChild->getBalance() <= 0) {
+         this->recordRotation(false);
          return rotateLeft(root);
     } else {
+         this->recordRotation(true);
          root->setRight(rotateRight(rightChild));
          if(root->getRight() != nullptr)
               root->getRight()->setParent(root);
@@ -303,74 +1207,44 @@ AVLNode<Key,Value>* AVLTree<Key,Value>::balanceRight(AVLNode<Key,Value>* root)
     }
 }
 
-template<class Key, class Value>
-int AVLTree<Key,Value>::calcHeight(AVLNode<Key,Value>* node)
+// Rotates the out-of-balance subtree at node and links the new subtree root
+// into node's old place.
+template<class Key, class Value, class Compare>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare>::rebalance(AVLNode<Key,Value>* node)
 {
-    if(node == nullptr)
-         return 0;
-    int leftH = calcHeight(static_cast<AVLNode<Key,Value>*>(node->getLeft()));
-    int rightH = calcHeight(static_cast<AVLNode<Key,Value>*>(node->getRight()));
-    return 1 + std::max(leftH, rightH);
+    AVLNode<Key,Value>* parent = node->getParent();
+    bool wasLeft = (parent != nullptr && parent->getLeft() == node);
+    AVLNode<Key,Value>* subtree = (node->getBalance() > 0) ? balanceLeft(node) : balanceRight(node);
+    if(parent == nullptr)
+         this->root_ = subtree;
+    else if(wasLeft)
+         parent->setLeft(subtree);
+    else
+         parent->setRight(subtree);
+    return subtree;
 }
 
 /*-------------------------------------------------
   Override nodeSwap for AVLNodes.
-  This implementation provides special handling for adjacent nodes.
+  The base class relinks the nodes; the balance factors belong to the
+  positions, so they are swapped as well.
 -------------------------------------------------*/
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
-{
-    // If n2 is the direct left child of n1.
-    if(n1->getLeft() == n2) {
-       AVLNode<Key,Value>* temp = n2->getRight();
-       n2->setRight(n1);
-       n1->setParent(n2);
-       n1->setLeft(temp);
-       if(temp) temp->setParent(n1);
-       AVLNode<Key,Value>* P = static_cast<AVLNode<Key,Value>*>(n1->getParent());
-       n2->setParent(P);
-       if(P) {
-           if(P->getLeft() == n1)
-              P->setLeft(n2);
-           else if(P->getRight() == n1)
-              P->setRight(n2);
-       }
-       int8_t tempB = n1->getBalance();
-       n1->setBalance(n2->getBalance());
-       n2->setBalance(tempB);
-       if(this->root_ == n1)
-           this->root_ = n2;
-       return;
-    }
-    // Else if n2 is the direct right child of n1.
-    else if(n1->getRight() == n2) {
-       AVLNode<Key,Value>* temp = n2->getLeft();
-       n2->setLeft(n1);
-       n1->setParent(n2);
-       n1->setRight(temp);
-       if(temp) temp->setParent(n1);
-       AVLNode<Key,Value>* P = static_cast<AVLNode<Key,Value>*>(n1->getParent());
-       n2->setParent(P);
-       if(P) {
-           if(P->getLeft() == n1)
-              P->setLeft(n2);
-           else if(P->getRight() == n1)
-              P->setRight(n2);
-       }
-       int8_t tempB = n1->getBalance();
-       n1->setBalance(n2->getBalance());
-       n2->setBalance(tempB);
-       if(this->root_ == n1)
-           this->root_ = n2;
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2)
+{
+    if(n1 == n2 || n1 == nullptr || n2 == nullptr)
        return;
-    }
-    else {
-       // For non-adjacent nodes, use the base BST nodeSwap.
-       BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-       int8_t tempB = n1->getBalance();
-       n1->setBalance(n2->getBalance());
-       n2->setBalance(tempB);
-    }
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    AVLNode<Key,Value>* a1 = static_cast<AVLNode<Key,Value>*>(n1);
+    AVLNode<Key,Value>* a2 = static_cast<AVLNode<Key,Value>*>(n2);
+    int8_t tempB = a1->getBalance();
+    a1->setBalance(a2->getBalance());
+    a2->setBalance(tempB);
+#ifdef AVL_ORDER_STATISTICS
+    std::size_t tempS = a1->getSubtreeSize();
+    a1->setSubtreeSize(a2->getSubtreeSize());
+    a2->setSubtreeSize(tempS);
+#endif
 }
 
 #endif
@@ -0,0 +1,701 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+#include "bst.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Which key widths get a vectorized node search in this build.  32-bit keys
+// need SSE2 (always present on x86-64); 64-bit keys need the 64-bit compare
+// from SSE4.2 or AVX2.  Everything else uses the scalar loop.
+#if defined(__AVX2__) || defined(__SSE2__)
+#define BPLUSTREE_SIMD32 1
+#else
+#define BPLUSTREE_SIMD32 0
+#endif
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#define BPLUSTREE_SIMD64 1
+#else
+#define BPLUSTREE_SIMD64 0
+#endif
+
+/**
+ * A B+ tree with the same find/insert/remove and iterator contract as
+ * BinarySearchTree, for workloads where the binary tree's one comparison per
+ * cache miss is the bottleneck.
+ *
+ * Every node holds up to NODE_KEYS sorted keys, so a lookup visits a handful
+ * of nodes instead of ~log2(n).  Key/value pairs live only in the leaves,
+ * which are chained left to right for iteration; inner nodes hold separator
+ * keys, where child i covers keys in [keys[i-1], keys[i]).
+ *
+ * Within a node the search is a vector compare of the probe key against all
+ * NODE_KEYS keys at once, turned into a bit mask with movemask; the number of
+ * set bits is the position.  This is used for 32- and 64-bit integral keys
+ * (signed or unsigned) ordered by DefaultCompare when the build enables the
+ * needed instruction set; otherwise a scalar loop calls the three-way
+ * comparator Compare, as BinarySearchTree does.  Key and Value must be
+ * default constructible, since nodes are arrays of them.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
+class BPlusTree {
+public:
+    static const int NODE_KEYS = 16;
+    // Whether node search uses the vector kernels for this Key in this build.
+    static constexpr bool SIMD_NODE_SEARCH = std::is_integral<Key>::value &&
+        std::is_same<Compare, DefaultCompare<Key> >::value &&
+        ((sizeof(Key) == 4 && BPLUSTREE_SIMD32) || (sizeof(Key) == 8 && BPLUSTREE_SIMD64));
+
+private:
+    static const int MIN_KEYS = NODE_KEYS / 2;
+
+    struct NodeHeader {
+        bool leaf;
+        int count;
+    };
+    struct Inner : public NodeHeader {
+        Key keys[NODE_KEYS];
+        NodeHeader* children[NODE_KEYS + 1];
+    };
+    struct Leaf : public NodeHeader {
+        Key keys[NODE_KEYS];
+        Value values[NODE_KEYS];
+        Leaf* next;
+    };
+
+public:
+    /**
+    * Iterates over the leaves in key order.  Keys and values are stored in
+    * separate arrays, so dereferencing yields a pair of references.
+    */
+    class iterator {
+    public:
+        typedef std::pair<const Key&, Value&> reference;
+
+        // Lets it->first / it->second work on the reference pair.
+        class pointer {
+        public:
+            explicit pointer(const reference& ref) : ref_(ref) {}
+            const reference* operator->() const { return &ref_; }
+        private:
+            reference ref_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    private:
+        friend class BPlusTree<Key, Value, Compare>;
+        iterator(Leaf* leaf, int index);
+
+        Leaf* leaf_;
+        int index_;
+    };
+
+    BPlusTree();
+    ~BPlusTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+
+private:
+    // Trees own their nodes' pools, so they cannot be copied.
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+    // Node search kernels.
+    int countLess(const Key* keys, int count, const Key& key) const;
+    static unsigned lessMask(const Key* keys, const Key& key);
+    int childIndex(const Inner* node, const Key& key) const;
+
+    Leaf* newLeaf();
+    Inner* newInner();
+    void destroyNode(NodeHeader* node);
+    void destroySubtree(NodeHeader* node);
+
+    // Inserts into the subtree at node.  If node had to split, returns the
+    // new right sibling and sets separator to its smallest key.
+    NodeHeader* insertHelper(NodeHeader* node, const Key& key, const Value& value, Key& separator);
+    NodeHeader* splitLeaf(Leaf* leaf, int pos, const Key& key, const Value& value, Key& separator);
+    NodeHeader* insertIntoInner(Inner* node, int pos, const Key& key, NodeHeader* child, Key& separator);
+
+    // Removes key from the subtree at node; repairs underfull children.
+    bool removeHelper(NodeHeader* node, const Key& key);
+    void fixChild(Inner* parent, int idx);
+    void borrowFromLeft(Inner* parent, int idx);
+    void borrowFromRight(Inner* parent, int idx);
+    void mergeChildren(Inner* parent, int idx);
+
+    NodeHeader* root_;
+    std::size_t size_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+    Compare compare_;
+};
+
+/*
+-----------------------------------------------------
+Begin implementations for the BPlusTree::iterator class.
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::iterator::iterator()
+    : leaf_(nullptr), index_(0)
+{}
+
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::iterator::iterator(Leaf* leaf, int index)
+    : leaf_(leaf), index_(index)
+{}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator::reference
+BPlusTree<Key, Value, Compare>::iterator::operator*() const {
+    return reference(leaf_->keys[index_], leaf_->values[index_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator::pointer
+BPlusTree<Key, Value, Compare>::iterator::operator->() const {
+    return pointer(**this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const {
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const {
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator&
+BPlusTree<Key, Value, Compare>::iterator::operator++() {
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/*
+---------------------------------------------------
+End implementations for the BPlusTree::iterator class.
+---------------------------------------------------
+*/
+
+/*
+--------------------------------------------
+Begin implementations for the BPlusTree class.
+--------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::BPlusTree()
+    : root_(nullptr),
+      size_(0),
+      leafPool_(sizeof(Leaf), alignof(Leaf)),
+      innerPool_(sizeof(Inner), alignof(Inner))
+{}
+
+template<typename Key, typename Value, typename Compare>
+BPlusTree<Key, Value, Compare>::~BPlusTree() {
+    clear();
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::clear() {
+    if(!(std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value))
+        destroySubtree(root_);
+    root_ = nullptr;
+    size_ = 0;
+    leafPool_.release();
+    innerPool_.release();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::empty() const {
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t BPlusTree<Key, Value, Compare>::size() const {
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::begin() const {
+    NodeHeader* node = root_;
+    if(node == nullptr)
+        return end();
+    while(!node->leaf)
+        node = static_cast<Inner*>(node)->children[0];
+    return iterator(static_cast<Leaf*>(node), 0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::end() const {
+    return iterator(nullptr, 0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::find(const Key& key) const {
+    NodeHeader* node = root_;
+    if(node == nullptr)
+        return end();
+    while(!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[childIndex(inner, key)];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = countLess(leaf->keys, leaf->count, key);
+    if(pos < leaf->count && compare_(key, leaf->keys[pos]) == 0)
+        return iterator(leaf, pos);
+    return end();
+}
+
+/*
+-----------------------------------------------------
+Node search kernels
+-----------------------------------------------------
+*/
+// Returns how many of keys[0, count) are less than key, which is the index
+// of the first key not less than key.
+template<typename Key, typename Value, typename Compare>
+int BPlusTree<Key, Value, Compare>::countLess(const Key* keys, int count, const Key& key) const {
+    if(SIMD_NODE_SEARCH) {
+        // Slots past count hold stale keys, so their bits are masked off.
+        unsigned mask = lessMask(keys, key) & ((1u << count) - 1);
+        return __builtin_popcount(mask);
+    }
+    int i = 0;
+    while(i < count && compare_(keys[i], key) < 0)
+        ++i;
+    return i;
+}
+
+// Bit i of the result is set if keys[i] < key, for all NODE_KEYS slots.
+// Unsigned keys are compared as signed after flipping their top bit, which
+// maps unsigned order onto signed order.
+template<typename Key, typename Value, typename Compare>
+unsigned BPlusTree<Key, Value, Compare>::lessMask(const Key* keys, const Key& key) {
+    unsigned mask = 0;
+#if BPLUSTREE_SIMD32 || BPLUSTREE_SIMD64
+    if constexpr (std::is_integral<Key>::value && sizeof(Key) == 4) {
+        const int32_t flip = std::is_signed<Key>::value ? 0 : INT32_MIN;
+        const int32_t probe = static_cast<int32_t>(key) ^ flip;
+#if defined(__AVX2__)
+        const __m256i flips = _mm256_set1_epi32(flip);
+        const __m256i needle = _mm256_set1_epi32(probe);
+        for(int i = 0; i < NODE_KEYS; i += 8) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), flips);
+            __m256i less = _mm256_cmpgt_epi32(needle, block);
+            mask |= static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(less))) << i;
+        }
+#else
+        const __m128i flips = _mm_set1_epi32(flip);
+        const __m128i needle = _mm_set1_epi32(probe);
+        for(int i = 0; i < NODE_KEYS; i += 4) {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flips);
+            __m128i less = _mm_cmpgt_epi32(needle, block);
+            mask |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(less))) << i;
+        }
+#endif
+    }
+#if BPLUSTREE_SIMD64
+    else if constexpr (std::is_integral<Key>::value && sizeof(Key) == 8) {
+        const long long flip = std::is_signed<Key>::value ? 0 : INT64_MIN;
+        const long long probe = static_cast<long long>(key) ^ flip;
+#if defined(__AVX2__)
+        const __m256i flips = _mm256_set1_epi64x(flip);
+        const __m256i needle = _mm256_set1_epi64x(probe);
+        for(int i = 0; i < NODE_KEYS; i += 4) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), flips);
+            __m256i less = _mm256_cmpgt_epi64(needle, block);
+            mask |= static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(less))) << i;
+        }
+#else
+        const __m128i flips = _mm_set1_epi64x(flip);
+        const __m128i needle = _mm_set1_epi64x(probe);
+        for(int i = 0; i < NODE_KEYS; i += 2) {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flips);
+            __m128i less = _mm_cmpgt_epi64(needle, block);
+            mask |= static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(less))) << i;
+        }
+#endif
+    }
+#endif
+#endif
+    (void)keys;
+    (void)key;
+    return mask;
+}
+
+// Index of the child of node whose range contains key.
+template<typename Key, typename Value, typename Compare>
+int BPlusTree<Key, Value, Compare>::childIndex(const Inner* node, const Key& key) const {
+    int pos = countLess(node->keys, node->count, key);
+    if(pos < node->count && compare_(key, node->keys[pos]) == 0)
+        ++pos;
+    return pos;
+}
+
+/*
+-----------------------------------------------------
+Node allocation
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Leaf* BPlusTree<Key, Value, Compare>::newLeaf() {
+    Leaf* leaf = new (leafPool_.allocate()) Leaf();
+    leaf->leaf = true;
+    leaf->count = 0;
+    leaf->next = nullptr;
+    return leaf;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::Inner* BPlusTree<Key, Value, Compare>::newInner() {
+    Inner* inner = new (innerPool_.allocate()) Inner();
+    inner->leaf = false;
+    inner->count = 0;
+    return inner;
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::destroyNode(NodeHeader* node) {
+    if(node->leaf) {
+        static_cast<Leaf*>(node)->~Leaf();
+        leafPool_.deallocate(node);
+    }
+    else {
+        static_cast<Inner*>(node)->~Inner();
+        innerPool_.deallocate(node);
+    }
+}
+
+// Runs node destructors ahead of a pool release; the tree is only a few
+// levels deep, so recursion is fine here.
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::destroySubtree(NodeHeader* node) {
+    if(node == nullptr)
+        return;
+    if(node->leaf) {
+        static_cast<Leaf*>(node)->~Leaf();
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(int i = 0; i <= inner->count; ++i)
+        destroySubtree(inner->children[i]);
+    inner->~Inner();
+}
+
+/*
+-----------------------------------------------------
+Insertion
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair) {
+    if(root_ == nullptr)
+        root_ = newLeaf();
+    Key separator;
+    NodeHeader* sibling = insertHelper(root_, keyValuePair.first, keyValuePair.second, separator);
+    if(sibling != nullptr) {
+        // The root split: grow the tree by one level.
+        Inner* root = newInner();
+        root->count = 1;
+        root->keys[0] = separator;
+        root->children[0] = root_;
+        root->children[1] = sibling;
+        root_ = root;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::NodeHeader*
+BPlusTree<Key, Value, Compare>::insertHelper(NodeHeader* node, const Key& key, const Value& value, Key& separator) {
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = countLess(leaf->keys, leaf->count, key);
+        if(pos < leaf->count && compare_(key, leaf->keys[pos]) == 0) {
+            // Key already exists: update value.
+            leaf->values[pos] = value;
+            return nullptr;
+        }
+        ++size_;
+        if(leaf->count == NODE_KEYS)
+            return splitLeaf(leaf, pos, key, value, separator);
+        for(int i = leaf->count; i > pos; --i) {
+            leaf->keys[i] = std::move(leaf->keys[i - 1]);
+            leaf->values[i] = std::move(leaf->values[i - 1]);
+        }
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        ++leaf->count;
+        return nullptr;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int idx = childIndex(inner, key);
+    Key childSeparator;
+    NodeHeader* childSibling = insertHelper(inner->children[idx], key, value, childSeparator);
+    if(childSibling == nullptr)
+        return nullptr;
+    return insertIntoInner(inner, idx, childSeparator, childSibling, separator);
+}
+
+// Moves the upper half of a full leaf into a new right sibling, then puts the
+// new entry on whichever side it belongs.
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::NodeHeader*
+BPlusTree<Key, Value, Compare>::splitLeaf(Leaf* leaf, int pos, const Key& key, const Value& value, Key& separator) {
+    Leaf* right = newLeaf();
+    const int half = NODE_KEYS / 2;
+    for(int i = half; i < NODE_KEYS; ++i) {
+        right->keys[i - half] = std::move(leaf->keys[i]);
+        right->values[i - half] = std::move(leaf->values[i]);
+    }
+    leaf->count = half;
+    right->count = NODE_KEYS - half;
+    right->next = leaf->next;
+    leaf->next = right;
+
+    Leaf* target = (pos < half) ? leaf : right;
+    int at = (pos < half) ? pos : pos - half;
+    for(int i = target->count; i > at; --i) {
+        target->keys[i] = std::move(target->keys[i - 1]);
+        target->values[i] = std::move(target->values[i - 1]);
+    }
+    target->keys[at] = key;
+    target->values[at] = value;
+    ++target->count;
+
+    separator = right->keys[0];
+    return right;
+}
+
+// Adds separator key and its right-hand child at position pos of node.  A full
+// node splits around its middle key, which moves up as the new separator.
+template<typename Key, typename Value, typename Compare>
+typename BPlusTree<Key, Value, Compare>::NodeHeader*
+BPlusTree<Key, Value, Compare>::insertIntoInner(Inner* node, int pos, const Key& key, NodeHeader* child, Key& separator) {
+    if(node->count < NODE_KEYS) {
+        for(int i = node->count; i > pos; --i) {
+            node->keys[i] = std::move(node->keys[i - 1]);
+            node->children[i + 1] = node->children[i];
+        }
+        node->keys[pos] = key;
+        node->children[pos + 1] = child;
+        ++node->count;
+        return nullptr;
+    }
+
+    // Lay out all NODE_KEYS + 1 separators in order, then cut.
+    Key keys[NODE_KEYS + 1];
+    NodeHeader* children[NODE_KEYS + 2];
+    for(int i = 0, j = 0; i <= NODE_KEYS; ++i)
+        keys[i] = (i == pos) ? key : std::move(node->keys[j++]);
+    for(int i = 0, j = 0; i <= NODE_KEYS + 1; ++i)
+        children[i] = (i == pos + 1) ? child : node->children[j++];
+
+    const int middle = (NODE_KEYS + 1) / 2;
+    Inner* right = newInner();
+    node->count = middle;
+    for(int i = 0; i < middle; ++i) {
+        node->keys[i] = std::move(keys[i]);
+        node->children[i] = children[i];
+    }
+    node->children[middle] = children[middle];
+    right->count = NODE_KEYS - middle;
+    for(int i = middle + 1; i <= NODE_KEYS; ++i) {
+        right->keys[i - middle - 1] = std::move(keys[i]);
+        right->children[i - middle - 1] = children[i];
+    }
+    right->children[right->count] = children[NODE_KEYS + 1];
+    separator = std::move(keys[middle]);
+    return right;
+}
+
+/*
+-----------------------------------------------------
+Removal
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::remove(const Key& key) {
+    if(root_ == nullptr || !removeHelper(root_, key))
+        return;
+    --size_;
+    if(root_->count == 0) {
+        // An emptied inner root hands over to its only child; an emptied
+        // leaf root leaves the tree empty.
+        NodeHeader* old = root_;
+        root_ = old->leaf ? nullptr : static_cast<Inner*>(old)->children[0];
+        destroyNode(old);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+bool BPlusTree<Key, Value, Compare>::removeHelper(NodeHeader* node, const Key& key) {
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = countLess(leaf->keys, leaf->count, key);
+        if(pos == leaf->count || compare_(key, leaf->keys[pos]) != 0)
+            return false;
+        for(int i = pos + 1; i < leaf->count; ++i) {
+            leaf->keys[i - 1] = std::move(leaf->keys[i]);
+            leaf->values[i - 1] = std::move(leaf->values[i]);
+        }
+        --leaf->count;
+        return true;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    int idx = childIndex(inner, key);
+    if(!removeHelper(inner->children[idx], key))
+        return false;
+    if(inner->children[idx]->count < MIN_KEYS)
+        fixChild(inner, idx);
+    return true;
+}
+
+// Brings an underfull child back to MIN_KEYS by borrowing from a sibling
+// that can spare a key, or else by merging with one.
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::fixChild(Inner* parent, int idx) {
+    if(idx > 0 && parent->children[idx - 1]->count > MIN_KEYS)
+        borrowFromLeft(parent, idx);
+    else if(idx < parent->count && parent->children[idx + 1]->count > MIN_KEYS)
+        borrowFromRight(parent, idx);
+    else if(idx > 0)
+        mergeChildren(parent, idx - 1);
+    else
+        mergeChildren(parent, idx);
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::borrowFromLeft(Inner* parent, int idx) {
+    NodeHeader* child = parent->children[idx];
+    NodeHeader* left = parent->children[idx - 1];
+    if(child->leaf) {
+        Leaf* c = static_cast<Leaf*>(child);
+        Leaf* l = static_cast<Leaf*>(left);
+        for(int i = c->count; i > 0; --i) {
+            c->keys[i] = std::move(c->keys[i - 1]);
+            c->values[i] = std::move(c->values[i - 1]);
+        }
+        c->keys[0] = std::move(l->keys[l->count - 1]);
+        c->values[0] = std::move(l->values[l->count - 1]);
+        parent->keys[idx - 1] = c->keys[0];
+    }
+    else {
+        // Rotate through the parent: its separator comes down, the left
+        // sibling's last key goes up.
+        Inner* c = static_cast<Inner*>(child);
+        Inner* l = static_cast<Inner*>(left);
+        c->children[c->count + 1] = c->children[c->count];
+        for(int i = c->count; i > 0; --i) {
+            c->keys[i] = std::move(c->keys[i - 1]);
+            c->children[i] = c->children[i - 1];
+        }
+        c->keys[0] = std::move(parent->keys[idx - 1]);
+        c->children[0] = l->children[l->count];
+        parent->keys[idx - 1] = std::move(l->keys[l->count - 1]);
+    }
+    ++child->count;
+    --left->count;
+}
+
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::borrowFromRight(Inner* parent, int idx) {
+    NodeHeader* child = parent->children[idx];
+    NodeHeader* right = parent->children[idx + 1];
+    if(child->leaf) {
+        Leaf* c = static_cast<Leaf*>(child);
+        Leaf* r = static_cast<Leaf*>(right);
+        c->keys[c->count] = std::move(r->keys[0]);
+        c->values[c->count] = std::move(r->values[0]);
+        for(int i = 1; i < r->count; ++i) {
+            r->keys[i - 1] = std::move(r->keys[i]);
+            r->values[i - 1] = std::move(r->values[i]);
+        }
+        parent->keys[idx] = r->keys[0];
+    }
+    else {
+        Inner* c = static_cast<Inner*>(child);
+        Inner* r = static_cast<Inner*>(right);
+        c->keys[c->count] = std::move(parent->keys[idx]);
+        c->children[c->count + 1] = r->children[0];
+        parent->keys[idx] = std::move(r->keys[0]);
+        for(int i = 1; i < r->count; ++i)
+            r->keys[i - 1] = std::move(r->keys[i]);
+        for(int i = 1; i <= r->count; ++i)
+            r->children[i - 1] = r->children[i];
+    }
+    ++child->count;
+    --right->count;
+}
+
+// Folds child idx + 1 into child idx and drops the separator between them.
+template<typename Key, typename Value, typename Compare>
+void BPlusTree<Key, Value, Compare>::mergeChildren(Inner* parent, int idx) {
+    NodeHeader* left = parent->children[idx];
+    NodeHeader* right = parent->children[idx + 1];
+    if(left->leaf) {
+        Leaf* l = static_cast<Leaf*>(left);
+        Leaf* r = static_cast<Leaf*>(right);
+        for(int i = 0; i < r->count; ++i) {
+            l->keys[l->count + i] = std::move(r->keys[i]);
+            l->values[l->count + i] = std::move(r->values[i]);
+        }
+        l->count += r->count;
+        l->next = r->next;
+    }
+    else {
+        Inner* l = static_cast<Inner*>(left);
+        Inner* r = static_cast<Inner*>(right);
+        l->keys[l->count] = std::move(parent->keys[idx]);
+        for(int i = 0; i < r->count; ++i)
+            l->keys[l->count + 1 + i] = std::move(r->keys[i]);
+        for(int i = 0; i <= r->count; ++i)
+            l->children[l->count + 1 + i] = r->children[i];
+        l->count += r->count + 1;
+    }
+    destroyNode(right);
+
+    for(int i = idx + 1; i < parent->count; ++i) {
+        parent->keys[i - 1] = std::move(parent->keys[i]);
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->count;
+}
+
+/*
+------------------------------------------
+End implementations for the BPlusTree class.
+------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1088 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "bplustree.h"
+#include "concurrentavl.h"
+#include "mappedindex.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point start)
+{
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+// Inserts maxKeys keys into one AVL tree and reports the average cost of each
+// doubling batch.  If rebalancing is O(log n), ns/insert divided by log2(n)
+// stays flat as the tree grows.
+static void benchAvlInsert(size_t maxKeys, bool shuffled)
+{
+    vector<int> keys(maxKeys);
+    for(size_t i = 0; i < maxKeys; ++i)
+        keys[i] = static_cast<int>(i);
+    if(shuffled) {
+        mt19937 rng(12345);
+        shuffle(keys.begin(), keys.end(), rng);
+    }
+
+    cout << "avl-insert (" << (shuffled ? "random" : "sequential") << " keys)" << endl;
+    cout << setw(12) << "n" << setw(14) << "ns/insert" << setw(16) << "ns/log2(n)" << endl;
+
+    AVLTree<int, int> tree;
+    size_t done = 0;
+    for(size_t batchEnd = 1024; done < maxKeys; batchEnd *= 2) {
+        if(batchEnd > maxKeys)
+            batchEnd = maxKeys;
+        Clock::time_point start = Clock::now();
+        for(size_t i = done; i < batchEnd; ++i)
+            tree.insert(std::make_pair(keys[i], keys[i]));
+        double perInsert = elapsedNs(start) / static_cast<double>(batchEnd - done);
+        done = batchEnd;
+        cout << setw(12) << done << setw(14) << fixed << setprecision(1) << perInsert
+             << setw(16) << setprecision(2) << perInsert / log2(static_cast<double>(done)) << endl;
+    }
+    cout << endl;
+}
+
+// Times building an n-key AVL tree and tearing it down with clear().
+static void benchAvlClear(size_t n)
+{
+    mt19937 rng(12345);
+    AVLTree<int, int> tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        int key = static_cast<int>(rng());
+        tree.insert(std::make_pair(key, key));
+    }
+    double insertNs = elapsedNs(start);
+    start = Clock::now();
+    tree.clear();
+    double clearNs = elapsedNs(start);
+
+    cout << "avl-clear (" << n << " random keys)" << endl;
+    cout << "  insert: " << fixed << setprecision(1) << insertNs / n << " ns/insert" << endl;
+    cout << "  clear:  " << setprecision(3) << clearNs / 1e6 << " ms total" << endl << endl;
+}
+
+// Loads n sorted records with buildFromSorted() and with n inserts.
+static void benchBulkLoad(size_t n)
+{
+    vector<pair<int, int> > records(n);
+    for(size_t i = 0; i < n; ++i)
+        records[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+
+    AVLTree<int, int> built;
+    Clock::time_point start = Clock::now();
+    built.buildFromSorted(records.begin(), records.end());
+    double buildNs = elapsedNs(start);
+
+    AVLTree<int, int> inserted;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        inserted.insert(records[i]);
+    double insertNs = elapsedNs(start);
+
+    cout << "bulk-load (" << n << " sorted records)" << endl;
+    cout << "  buildFromSorted: " << fixed << setprecision(1) << buildNs / n << " ns/record" << endl;
+    cout << "  insert loop:     " << insertNs / n << " ns/record" << endl << endl;
+}
+
+// Compares lookups in an AVL tree with lookups in its frozen index.
+static void benchFrozen(size_t n)
+{
+    mt19937 rng(12345);
+    AVLTree<int, int> tree;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(rng());
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point start = Clock::now();
+    FrozenIndex<int, int> index = tree.freeze();
+    double freezeNs = elapsedNs(start);
+    shuffle(keys.begin(), keys.end(), rng);
+
+    long long checksum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum += tree.find(keys[i])->second;
+    double treeNs = elapsedNs(start) / n;
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum -= index.find(keys[i])->second;
+    double frozenNs = elapsedNs(start) / n;
+
+    cout << "frozen (" << n << " random keys, checksum " << checksum << ")" << endl;
+    cout << "  freeze: " << fixed << setprecision(3) << freezeNs / 1e6 << " ms" << endl;
+    cout << "  find: AVLTree " << setprecision(1) << treeNs << " ns/op, FrozenIndex "
+         << frozenNs << " ns/op" << endl << endl;
+}
+
+// The node layout before traversal was devirtualized: virtual getters
+// (and so a vtable pointer in every node), overridden by the AVL node.
+template <typename Key, typename Value>
+struct LegacyNode {
+    LegacyNode(const Key& key, const Value& value) : item(key, value), parent(NULL), left(NULL), right(NULL) { }
+    virtual ~LegacyNode() { }
+    virtual LegacyNode* getParent() const { return parent; }
+    virtual LegacyNode* getLeft() const { return left; }
+    virtual LegacyNode* getRight() const { return right; }
+
+    std::pair<const Key, Value> item;
+    LegacyNode* parent;
+    LegacyNode* left;
+    LegacyNode* right;
+};
+
+template <typename Key, typename Value>
+struct LegacyAVLNode : public LegacyNode<Key, Value> {
+    LegacyAVLNode(const Key& key, const Value& value) : LegacyNode<Key, Value>(key, value), balance(0) { }
+    virtual LegacyAVLNode* getParent() const { return static_cast<LegacyAVLNode*>(this->parent); }
+    virtual LegacyAVLNode* getLeft() const { return static_cast<LegacyAVLNode*>(this->left); }
+    virtual LegacyAVLNode* getRight() const { return static_cast<LegacyAVLNode*>(this->right); }
+    int8_t balance;
+};
+
+// Links legacy copies (already allocated, looked up by key) into the shape
+// of an AVL subtree.
+static LegacyNode<int, int>* linkLegacy(Node<int, int>* node, LegacyNode<int, int>* parent,
+                                        unordered_map<int, LegacyNode<int, int>*>& copies)
+{
+    if(node == NULL)
+        return NULL;
+    LegacyNode<int, int>* copy = copies[node->getKey()];
+    copy->parent = parent;
+    copy->left = linkLegacy(node->getLeft(), copy, copies);
+    copy->right = linkLegacy(node->getRight(), copy, copies);
+    return copy;
+}
+
+static void freeLegacy(LegacyNode<int, int>* node)
+{
+    if(node == NULL)
+        return;
+    freeLegacy(node->left);
+    freeLegacy(node->right);
+    delete node;
+}
+
+// Same loop as BinarySearchTree::internalFind, through the virtual getters.
+static LegacyNode<int, int>* legacyFind(LegacyNode<int, int>* current, int key)
+{
+    while(current != NULL) {
+        if(key < current->item.first)
+            current = current->getLeft();
+        else if(current->item.first < key)
+            current = current->getRight();
+        else
+            return current;
+    }
+    return NULL;
+}
+
+// Exposes the root so the legacy copy can mirror the tree's exact shape.
+class LayoutBenchTree : public AVLTree<int, int> {
+public:
+    Node<int, int>* root() const { return root_; }
+};
+
+// Compares lookups on identically shaped trees in the current node layout
+// and in the old virtual-getter layout.
+static void benchNodeLayout(size_t n)
+{
+    mt19937 rng(12345);
+    LayoutBenchTree tree;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(rng());
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    // Allocate the copies in insertion order, as the old tree would have.
+    unordered_map<int, LegacyNode<int, int>*> copies;
+    for(size_t i = 0; i < n; ++i) {
+        if(copies.count(keys[i]) == 0)
+            copies[keys[i]] = new LegacyAVLNode<int, int>(keys[i], keys[i]);
+    }
+    LegacyNode<int, int>* legacyRoot = linkLegacy(tree.root(), NULL, copies);
+    shuffle(keys.begin(), keys.end(), rng);
+
+    long long checksum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum += tree.find(keys[i])->second;
+    double currentNs = elapsedNs(start) / n;
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum -= legacyFind(legacyRoot, keys[i])->item.second;
+    double legacyNs = elapsedNs(start) / n;
+    freeLegacy(legacyRoot);
+
+    cout << "node-layout (" << n << " random keys, checksum " << checksum << ")" << endl;
+    cout << "  sizeof AVLNode<uint64_t,uint64_t>: current " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << " bytes, legacy " << sizeof(LegacyAVLNode<uint64_t, uint64_t>) << " bytes" << endl;
+    cout << "  find: current " << fixed << setprecision(1) << currentNs << " ns/op, legacy "
+         << legacyNs << " ns/op" << endl << endl;
+}
+
+// Times n random inserts and n shuffled finds into one tree type.
+template <typename Tree, typename Key>
+static void timeTree(const vector<Key>& keys, double& insertNs, double& findNs, long long& checksum)
+{
+    vector<Key> probes(keys);
+    mt19937 rng(54321);
+    shuffle(probes.begin(), probes.end(), rng);
+
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i)
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    insertNs = elapsedNs(start) / keys.size();
+
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); ++i)
+        checksum += static_cast<long long>(tree.find(probes[i])->second);
+    findNs = elapsedNs(start) / probes.size();
+}
+
+// Compares BPlusTree with AVLTree at 1M, 10M, 100M keys, stopping at maxKeys.
+template <typename Key>
+static void benchBPlus(size_t maxKeys, const char* keyName)
+{
+    cout << "bplus (" << keyName << " random keys, " << BPlusTree<Key, Key>::NODE_KEYS
+         << " keys/node, " << (BPlusTree<Key, Key>::SIMD_NODE_SEARCH ? "SIMD" : "scalar")
+         << " node search)" << endl;
+    cout << setw(12) << "n" << setw(14) << "AVL insert" << setw(14) << "B+ insert"
+         << setw(14) << "AVL find" << setw(14) << "B+ find" << "   (ns/op)" << endl;
+    for(size_t n = 1000000; ; n *= 10) {
+        if(n > maxKeys)
+            n = maxKeys;
+        mt19937_64 rng(12345);
+        vector<Key> keys(n);
+        for(size_t i = 0; i < n; ++i)
+            keys[i] = static_cast<Key>(rng());
+
+        double avlInsert, avlFind, bplusInsert, bplusFind;
+        long long avlSum = 0, bplusSum = 0;
+        timeTree<AVLTree<Key, Key> >(keys, avlInsert, avlFind, avlSum);
+        timeTree<BPlusTree<Key, Key> >(keys, bplusInsert, bplusFind, bplusSum);
+        cout << setw(12) << n << fixed << setprecision(1) << setw(14) << avlInsert << setw(14) << bplusInsert
+             << setw(14) << avlFind << setw(14) << bplusFind << (avlSum == bplusSum ? "" : "   checksum mismatch") << endl;
+        if(n == maxKeys || n >= 100000000)
+            break;
+    }
+    cout << endl;
+}
+
+// The baseline the concurrent tree replaces: one AVLTree behind one mutex.
+class LockedAVLTree {
+public:
+    void insert(const std::pair<const int, int>& keyValuePair)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        tree_.insert(keyValuePair);
+    }
+    void remove(int key)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        tree_.remove(key);
+    }
+    bool find(int key, int& value) const
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        AVLTree<int, int>::iterator it = tree_.find(key);
+        if(it == tree_.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+
+private:
+    AVLTree<int, int> tree_;
+    mutable std::mutex lock_;
+};
+
+// Runs opsPerThread operations on each of threads threads, readPercent of
+// them finds and the rest an even mix of inserts and removes, and returns
+// the total throughput in Mops/s.
+template <typename Tree>
+static double runMixed(Tree& tree, int keyRange, int threads, size_t opsPerThread, int readPercent)
+{
+    vector<std::thread> workers;
+    vector<long long> found(threads, 0);
+    Clock::time_point start = Clock::now();
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&tree, &found, keyRange, opsPerThread, readPercent, t]() {
+            mt19937 rng(1000 + t);
+            long long hits = 0;
+            int value;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int key = static_cast<int>(rng() % keyRange);
+                int op = static_cast<int>(rng() % 100);
+                if(op < readPercent)
+                    hits += tree.find(key, value);
+                else if(op % 2 == 0)
+                    tree.insert(std::make_pair(key, key));
+                else
+                    tree.remove(key);
+            }
+            found[t] = hits;
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+    double mops = static_cast<double>(threads) * opsPerThread / elapsedNs(start) * 1e3;
+    // Consume the hit counts so the finds cannot be optimized away.
+    long long hits = 0;
+    for(int t = 0; t < threads; ++t)
+        hits += found[t];
+    if(hits < 0)
+        cout << "no hits" << endl;
+    return mops;
+}
+
+// Compares ConcurrentAVLTree with a mutex-wrapped AVLTree as threads are
+// added, for a read-mostly and a write-heavy mix.
+static void benchConcurrent(size_t n)
+{
+    int keyRange = static_cast<int>(n < 1000000 ? n : 1000000);
+    size_t opsPerThread = 1000000;
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if(maxThreads < 4)
+        maxThreads = 4;
+
+    cout << "concurrent (" << keyRange << " keys, " << opsPerThread << " ops/thread, "
+         << std::thread::hardware_concurrency() << " hardware threads)" << endl;
+    cout << setw(10) << "reads %" << setw(10) << "threads" << setw(16) << "mutex+AVL" << setw(16)
+         << "ConcurrentAVL" << "   (Mops/s)" << endl;
+    const int readPercents[] = { 95, 50 };
+    for(int r = 0; r < 2; ++r) {
+        for(int threads = 1; threads <= maxThreads; threads *= 2) {
+            LockedAVLTree locked;
+            ConcurrentAVLTree<int, int> concurrent;
+            for(int key = 0; key < keyRange; key += 2) {
+                locked.insert(std::make_pair(key, key));
+                concurrent.insert(std::make_pair(key, key));
+            }
+            double lockedMops = runMixed(locked, keyRange, threads, opsPerThread, readPercents[r]);
+            double concurrentMops = runMixed(concurrent, keyRange, threads, opsPerThread, readPercents[r]);
+            cout << setw(10) << readPercents[r] << setw(10) << threads << fixed << setprecision(2)
+                 << setw(16) << lockedMops << setw(16) << concurrentMops << endl;
+        }
+    }
+    cout << endl;
+}
+
+// Merges a shard of n/10 random keys into an index of n random keys, by
+// inserting the shard's items one by one and with the join-based set
+// operations.
+static void benchSetOps(size_t n)
+{
+    size_t m = n / 10;
+    mt19937 rng(12345);
+    vector<pair<int, int> > index(n), shard(m);
+    for(size_t i = 0; i < n; ++i) {
+        int key = static_cast<int>(rng());
+        index[i] = make_pair(key, key);
+    }
+    for(size_t i = 0; i < m; ++i) {
+        // Half the shard's keys update existing entries.
+        int key = (i % 2 == 0) ? index[rng() % n].first : static_cast<int>(rng());
+        shard[i] = make_pair(key, key);
+    }
+
+    cout << "set-ops (index of " << n << " keys, shard of " << m << " keys, "
+         << std::thread::hardware_concurrency() << " hardware threads)" << endl;
+    const char* names[] = { "insert loop", "unite", "intersect", "subtract" };
+    for(int op = 0; op < 4; ++op) {
+        AVLTree<int, int> a, b;
+        for(size_t i = 0; i < n; ++i)
+            a.insert(index[i]);
+        for(size_t i = 0; i < m; ++i)
+            b.insert(shard[i]);
+        Clock::time_point start = Clock::now();
+        if(op == 0) {
+            for(AVLTree<int, int>::iterator it = b.begin(); it != b.end(); ++it)
+                a.insert(*it);
+        }
+        else if(op == 1)
+            a.unite(b);
+        else if(op == 2)
+            a.intersect(b);
+        else
+            a.subtract(b);
+        double ms = elapsedNs(start) / 1e6;
+        cout << "  " << left << setw(12) << names[op] << right << fixed << setprecision(3) << setw(10)
+             << ms << " ms, result size " << a.size() << endl;
+    }
+    cout << endl;
+}
+
+// Applies batches of 10k and 100k random keys to an n-key tree, one key at
+// a time and with insertBatch/removeBatch.
+static void benchBatch(size_t n)
+{
+    mt19937 rng(12345);
+    vector<pair<int, int> > base(n);
+    for(size_t i = 0; i < n; ++i) {
+        int key = static_cast<int>(rng());
+        base[i] = make_pair(key, key);
+    }
+    AVLTree<int, int> perKey, batched;
+    for(size_t i = 0; i < n; ++i) {
+        perKey.insert(base[i]);
+        batched.insert(base[i]);
+    }
+
+    cout << "batch (tree of " << n << " random keys)" << endl;
+    cout << setw(10) << "batch" << setw(14) << "insert" << setw(14) << "insertBatch"
+         << setw(14) << "remove" << setw(14) << "removeBatch" << "   (ns/key)" << endl;
+    const size_t batchSizes[] = { 10000, 100000 };
+    for(int b = 0; b < 2; ++b) {
+        size_t k = batchSizes[b];
+        vector<pair<int, int> > batch(k);
+        vector<int> keys(k);
+        for(size_t i = 0; i < k; ++i) {
+            int key = static_cast<int>(rng());
+            batch[i] = make_pair(key, key);
+            keys[i] = key;
+        }
+
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < k; ++i)
+            perKey.insert(batch[i]);
+        double insertNs = elapsedNs(start) / k;
+        start = Clock::now();
+        batched.insertBatch(batch.begin(), batch.end());
+        double insertBatchNs = elapsedNs(start) / k;
+
+        start = Clock::now();
+        for(size_t i = 0; i < k; ++i)
+            perKey.remove(keys[i]);
+        double removeNs = elapsedNs(start) / k;
+        start = Clock::now();
+        batched.removeBatch(keys.begin(), keys.end());
+        double removeBatchNs = elapsedNs(start) / k;
+
+        cout << setw(10) << k << fixed << setprecision(1) << setw(14) << insertNs << setw(14) << insertBatchNs
+             << setw(14) << removeNs << setw(14) << removeBatchNs
+             << (perKey.size() == batched.size() ? "" : "   size mismatch") << endl;
+    }
+    cout << endl;
+}
+
+// Saves an n-key tree and compares rebuilding it with load() against
+// serving finds straight from the mapped file.
+static void benchSnapshot(size_t n)
+{
+    const char* path = "bst-bench.snapshot";
+    mt19937 rng(12345);
+    AVLTree<int, int> tree;
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(rng());
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+
+    Clock::time_point start = Clock::now();
+    tree.save(path);
+    double saveNs = elapsedNs(start);
+
+    AVLTree<int, int> loaded;
+    start = Clock::now();
+    loaded.load(path);
+    double loadNs = elapsedNs(start);
+
+    start = Clock::now();
+    MappedIndex<int, int> mapped(path, false);
+    double mapNs = elapsedNs(start);
+    start = Clock::now();
+    MappedIndex<int, int> verified(path);
+    double verifyNs = elapsedNs(start);
+
+    long long checksum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum += loaded.find(keys[i])->second;
+    double treeNs = elapsedNs(start) / n;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        checksum -= *mapped.find(keys[i]);
+    double mappedNs = elapsedNs(start) / n;
+    std::remove(path);
+
+    cout << "snapshot (" << n << " random keys, checksum " << checksum << ")" << endl;
+    cout << "  save: " << fixed << setprecision(3) << saveNs / 1e6 << " ms, load: " << loadNs / 1e6
+         << " ms, map: " << mapNs / 1e6 << " ms, map+verify: " << verifyNs / 1e6 << " ms" << endl;
+    cout << "  find: loaded AVLTree " << setprecision(1) << treeNs << " ns/op, MappedIndex "
+         << mappedNs << " ns/op" << endl << endl;
+}
+
+// The benchmark suite behind "make bench": every combination of tree type,
+// key order and operation, as one CSV or JSON row with ns/op, throughput
+// and peak RSS.  Keys come from fixed seeds, so runs are reproducible.
+struct SuiteRow {
+    const char* op;
+    size_t ops;
+    double ns;
+};
+
+enum KeyOrder { SEQUENTIAL, RANDOM, ZIPF, ADVERSARIAL };
+static const char* const KEY_ORDER_NAMES[] = { "sequential", "random", "zipf", "adversarial" };
+
+// The unbalanced tree degenerates into a list under sequential and
+// adversarial keys, so it gets at most this many of them.
+static const size_t DEGENERATE_MAX_KEYS = 20000;
+
+// Each case runs this many times and reports its fastest time per
+// operation, which filters out most of the noise from other processes.
+static const int SUITE_REPEATS = 3;
+
+static volatile long long suiteSink;
+
+// Spreads ranks over the int range in an order unrelated to the rank.
+static int scrambleKey(uint32_t rank)
+{
+    return static_cast<int>(rank * 2654435761u);
+}
+
+// count keys whose ranks in [0, n) are Zipf-distributed with s = 0.99, by
+// inverting the continuous approximation of the CDF.
+static vector<int> zipfKeys(size_t n, size_t count, mt19937& rng)
+{
+    const double s = 0.99;
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    double top = pow(static_cast<double>(n) + 1.0, 1.0 - s) - 1.0;
+    vector<int> keys(count);
+    for(size_t i = 0; i < count; ++i) {
+        double rank = pow(top * uniform(rng) + 1.0, 1.0 / (1.0 - s)) - 1.0;
+        keys[i] = scrambleKey(static_cast<uint32_t>(min(rank, static_cast<double>(n - 1))));
+    }
+    return keys;
+}
+
+// Fills the keys to insert and the keys to look up for one key order.
+// Adversarial keys alternate between the two ends of the range (0, n-1,
+// 1, n-2, ...), a zigzag that is as deep as the unbalanced tree can get
+// and keeps the AVL tree rotating on every insert.
+static void makeWorkload(KeyOrder order, size_t n, vector<int>& inserts, vector<int>& queries)
+{
+    mt19937 rng(12345);
+    inserts.resize(n);
+    if(order == SEQUENTIAL) {
+        for(size_t i = 0; i < n; ++i)
+            inserts[i] = static_cast<int>(i);
+        queries = inserts;
+    }
+    else if(order == RANDOM) {
+        for(size_t i = 0; i < n; ++i)
+            inserts[i] = scrambleKey(static_cast<uint32_t>(i));
+        shuffle(inserts.begin(), inserts.end(), rng);
+        queries = inserts;
+        shuffle(queries.begin(), queries.end(), rng);
+    }
+    else if(order == ZIPF) {
+        inserts = zipfKeys(n, n, rng);
+        queries = zipfKeys(n, n, rng);
+    }
+    else {
+        for(size_t i = 0; i < n; ++i)
+            inserts[i] = static_cast<int>((i % 2 == 0) ? i / 2 : n - 1 - i / 2);
+        queries = inserts;
+    }
+}
+
+template <typename Key, typename Value>
+static void suiteErase(BinarySearchTree<Key, Value>& tree, const Key& key)
+{
+    tree.remove(key);
+}
+
+template <typename Key, typename Value>
+static void suiteErase(map<Key, Value>& tree, const Key& key)
+{
+    tree.erase(key);
+}
+
+// Builds a tree from inserts, then times finds, a full in-order walk, a
+// mixed stream (80% find, 10% insert, 10% remove), removing every other
+// inserted key, and clearing what is left.
+template <typename Tree>
+static vector<SuiteRow> runSuiteCase(const vector<int>& inserts, const vector<int>& queries)
+{
+    vector<SuiteRow> rows;
+    long long checksum = 0;
+    Tree tree;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < inserts.size(); ++i)
+        tree.insert_or_assign(inserts[i], inserts[i]);
+    rows.push_back(SuiteRow{ "insert", inserts.size(), elapsedNs(start) });
+
+    start = Clock::now();
+    for(size_t i = 0; i < queries.size(); ++i) {
+        typename Tree::iterator it = tree.find(queries[i]);
+        if(it != tree.end())
+            checksum += it->second;
+    }
+    rows.push_back(SuiteRow{ "find", queries.size(), elapsedNs(start) });
+
+    size_t visited = 0;
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++visited)
+        checksum += it->second;
+    rows.push_back(SuiteRow{ "iterate", visited, elapsedNs(start) });
+
+    start = Clock::now();
+    for(size_t i = 0; i < queries.size(); ++i) {
+        if(i % 10 == 0)
+            tree.insert_or_assign(queries[i], static_cast<int>(i));
+        else if(i % 10 == 1)
+            suiteErase(tree, queries[i]);
+        else {
+            typename Tree::iterator it = tree.find(queries[i]);
+            if(it != tree.end())
+                checksum += it->second;
+        }
+    }
+    rows.push_back(SuiteRow{ "mixed", queries.size(), elapsedNs(start) });
+
+    start = Clock::now();
+    for(size_t i = 0; i < inserts.size(); i += 2)
+        suiteErase(tree, inserts[i]);
+    rows.push_back(SuiteRow{ "remove", (inserts.size() + 1) / 2, elapsedNs(start) });
+
+    size_t remaining = tree.size();
+    start = Clock::now();
+    tree.clear();
+    rows.push_back(SuiteRow{ "clear", remaining, elapsedNs(start) });
+
+    suiteSink = checksum;
+    return rows;
+}
+
+// Runs one case in a child process, so that the peak RSS reported is that
+// case's alone.  The keys are generated in the child too, so they count
+// towards it the same way for every tree.
+template <typename Tree>
+static bool forkSuiteCase(KeyOrder order, size_t n, vector<SuiteRow>& rows, long& peakRssKb)
+{
+    int fds[2];
+    if(pipe(fds) != 0)
+        return false;
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        vector<int> inserts, queries;
+        makeWorkload(order, n, inserts, queries);
+        vector<SuiteRow> result = runSuiteCase<Tree>(inserts, queries);
+        ssize_t bytes = static_cast<ssize_t>(result.size() * sizeof(SuiteRow));
+        _exit(write(fds[1], result.data(), bytes) == bytes ? 0 : 1);
+    }
+    close(fds[1]);
+    SuiteRow row;
+    rows.clear();
+    while(read(fds[0], &row, sizeof(row)) == static_cast<ssize_t>(sizeof(row)))
+        rows.push_back(row);
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return false;
+    peakRssKb = usage.ru_maxrss;
+    return true;
+}
+
+template <typename Tree>
+static void runSuiteTree(const char* treeName, size_t n, bool json, bool& first)
+{
+    for(int order = SEQUENTIAL; order <= ADVERSARIAL; ++order) {
+        size_t keys = n;
+        if(std::is_same<Tree, BinarySearchTree<int, int> >::value && (order == SEQUENTIAL || order == ADVERSARIAL))
+            keys = min(n, DEGENERATE_MAX_KEYS);
+        vector<SuiteRow> rows, repeat;
+        long peakRssKb = 0, repeatRssKb = 0;
+        bool ok = true;
+        for(int r = 0; r < SUITE_REPEATS && ok; ++r) {
+            ok = forkSuiteCase<Tree>(static_cast<KeyOrder>(order), keys, repeat, repeatRssKb);
+            peakRssKb = max(peakRssKb, repeatRssKb);
+            for(size_t i = 0; ok && i < repeat.size(); ++i) {
+                if(r == 0)
+                    rows.push_back(repeat[i]);
+                else
+                    rows[i].ns = min(rows[i].ns, repeat[i].ns);
+            }
+        }
+        if(!ok) {
+            cerr << "suite: " << treeName << "/" << KEY_ORDER_NAMES[order] << " failed" << endl;
+            continue;
+        }
+        for(size_t i = 0; i < rows.size(); ++i) {
+            double nsPerOp = rows[i].ops > 0 ? rows[i].ns / rows[i].ops : 0.0;
+            double opsPerSec = rows[i].ns > 0 ? rows[i].ops * 1e9 / rows[i].ns : 0.0;
+            if(json) {
+                cout << (first ? "" : ",\n") << "    {\"tree\": \"" << treeName
+                     << "\", \"keys\": \"" << KEY_ORDER_NAMES[order] << "\", \"n\": " << keys
+                     << ", \"op\": \"" << rows[i].op << "\", \"ops\": " << rows[i].ops
+                     << ", \"ns_per_op\": " << fixed << setprecision(2) << nsPerOp
+                     << ", \"ops_per_sec\": " << setprecision(0) << opsPerSec
+                     << ", \"peak_rss_kb\": " << peakRssKb << "}";
+            }
+            else {
+                cout << treeName << "," << KEY_ORDER_NAMES[order] << "," << keys << "," << rows[i].op << ","
+                     << rows[i].ops << "," << fixed << setprecision(2) << nsPerOp << ","
+                     << setprecision(0) << opsPerSec << "," << peakRssKb << endl;
+            }
+            first = false;
+        }
+    }
+}
+
+static void benchSuite(size_t n, const string& format)
+{
+    bool json = (format == "json");
+    bool first = true;
+    if(json)
+        cout << "{\n  \"benchmark\": \"bst-bench suite\",\n  \"n\": " << n << ",\n  \"results\": [\n";
+    else
+        cout << "tree,keys,n,op,ops,ns_per_op,ops_per_sec,peak_rss_kb" << endl;
+    runSuiteTree<BinarySearchTree<int, int> >("BinarySearchTree", n, json, first);
+    runSuiteTree<AVLTree<int, int> >("AVLTree", n, json, first);
+    runSuiteTree<RedBlackTree<int, int> >("RedBlackTree", n, json, first);
+    runSuiteTree<SplayTree<int, int> >("SplayTree", n, json, first);
+    runSuiteTree<map<int, int> >("std::map", n, json, first);
+    if(json)
+        cout << "\n  ]\n}" << endl;
+}
+
+// Looks up n keys of an n-key tree in AVLTree and SplayTree, under a
+// uniform trace and Zipfian traces of increasing skew.
+static void benchSplay(size_t n)
+{
+    mt19937 rng(12345);
+    AVLTree<int, int> avl;
+    SplayTree<int, int> splay;
+    for(size_t i = 0; i < n; ++i) {
+        int key = scrambleKey(static_cast<uint32_t>(i));
+        avl.insert(std::make_pair(key, key));
+        splay.insert(std::make_pair(key, key));
+    }
+
+    cout << "splay (" << n << " keys, " << n << " finds)" << endl;
+    cout << setw(14) << "trace" << setw(14) << "AVLTree" << setw(14) << "SplayTree" << "   (ns/find)" << endl;
+    const double skews[] = { 0.0, 0.8, 0.99, 1.2 };
+    for(int t = 0; t < 4; ++t) {
+        vector<int> trace(n);
+        if(skews[t] == 0.0) {
+            for(size_t i = 0; i < n; ++i)
+                trace[i] = scrambleKey(static_cast<uint32_t>(rng() % n));
+        }
+        else {
+            // Ranks drawn by inverting the continuous Zipf CDF, as in zipfKeys.
+            uniform_real_distribution<double> uniform(0.0, 1.0);
+            double s = skews[t];
+            double top = pow(static_cast<double>(n) + 1.0, 1.0 - s) - 1.0;
+            for(size_t i = 0; i < n; ++i) {
+                double rank = pow(top * uniform(rng) + 1.0, 1.0 / (1.0 - s)) - 1.0;
+                trace[i] = scrambleKey(static_cast<uint32_t>(min(rank, static_cast<double>(n - 1))));
+            }
+        }
+
+        long long checksum = 0;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i)
+            checksum += avl.find(trace[i])->second;
+        double avlNs = elapsedNs(start) / n;
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i)
+            checksum -= splay.find(trace[i])->second;
+        double splayNs = elapsedNs(start) / n;
+
+        ostringstream name;
+        if(skews[t] == 0.0)
+            name << "uniform";
+        else
+            name << "zipf " << skews[t];
+        cout << setw(14) << name.str() << fixed << setprecision(1) << setw(14) << avlNs << setw(14) << splayNs
+             << (checksum == 0 ? "" : "   checksum mismatch") << endl;
+    }
+    cout << endl;
+}
+
+// Runs ops operations on a tree already holding about half of keyRange
+// keys: writePercent of them insert or remove a random key (half each, so
+// the size stays put) and the rest are finds.  Returns ns per operation.
+template <typename Tree>
+static double runWriteMix(Tree& tree, int keyRange, size_t ops, int writePercent, long long& checksum)
+{
+    mt19937 rng(777);
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        uint32_t r = rng();
+        int key = scrambleKey(static_cast<uint32_t>(r % keyRange));
+        int dice = static_cast<int>((r >> 24) % 100);
+        if(dice >= writePercent) {
+            typename Tree::iterator it = tree.find(key);
+            if(it != tree.end())
+                checksum += it->second;
+        }
+        else if(dice % 2 == 0)
+            tree.insert(std::make_pair(key, key));
+        else
+            tree.remove(key);
+    }
+    return elapsedNs(start) / ops;
+}
+
+template <typename Tree>
+static void prefillWriteMix(Tree& tree, int keyRange)
+{
+    for(int i = 0; i < keyRange; i += 2)
+        tree.insert(std::make_pair(scrambleKey(static_cast<uint32_t>(i)), i));
+    tree.resetStats();
+}
+
+static void benchRedBlack(size_t n)
+{
+    int keyRange = static_cast<int>(2 * n);
+    cout << "red-black (" << n << " keys, " << n << " operations per mix)" << endl;
+    cout << setw(14) << "writes" << setw(14) << "AVLTree" << setw(14) << "RedBlackTree" << "   (ns/op)";
+#ifdef BST_STATS
+    cout << setw(14) << "AVL rot/op" << setw(14) << "RB rot/op";
+#endif
+    cout << endl;
+    const int writePercents[] = { 100, 90, 50, 10 };
+    for(int w = 0; w < 4; ++w) {
+        AVLTree<int, int> avl;
+        RedBlackTree<int, int> rb;
+        prefillWriteMix(avl, keyRange);
+        prefillWriteMix(rb, keyRange);
+        long long avlChecksum = 0;
+        long long rbChecksum = 0;
+        double avlNs = runWriteMix(avl, keyRange, n, writePercents[w], avlChecksum);
+        double rbNs = runWriteMix(rb, keyRange, n, writePercents[w], rbChecksum);
+        ostringstream name;
+        name << writePercents[w] << "%";
+        cout << setw(14) << name.str() << fixed << setprecision(1) << setw(14) << avlNs << setw(14) << rbNs;
+#ifdef BST_STATS
+        TreeStats a = avl.stats();
+        TreeStats r = rb.stats();
+        cout << setprecision(3) << setw(14) << double(a.singleRotations + 2 * a.doubleRotations) / n
+             << setw(14) << double(r.singleRotations + 2 * r.doubleRotations) / n;
+#endif
+        cout << (avlChecksum == rbChecksum && avl.size() == rb.size() ? "" : "   checksum mismatch") << endl;
+    }
+
+    // Ascending inserts, then removal from the front: a log-structured index.
+    AVLTree<int, int> avl;
+    RedBlackTree<int, int> rb;
+    Clock::time_point start = Clock::now();
+    for(int i = 0; i < keyRange; ++i)
+        avl.insert(std::make_pair(i, i));
+    for(int i = 0; i < keyRange; ++i)
+        avl.remove(i);
+    double avlNs = elapsedNs(start) / (2.0 * keyRange);
+    start = Clock::now();
+    for(int i = 0; i < keyRange; ++i)
+        rb.insert(std::make_pair(i, i));
+    for(int i = 0; i < keyRange; ++i)
+        rb.remove(i);
+    double rbNs = elapsedNs(start) / (2.0 * keyRange);
+    cout << setw(14) << "ascending" << fixed << setprecision(1) << setw(14) << avlNs << setw(14) << rbNs << endl;
+    cout << endl;
+}
+
+// Builds a tree from an append-mostly stream with insert() from the root and
+// with insert(end(), ...), then looks every key up again in stream order
+// with find() and with find(previous result, ...).  ns per operation.
+template <typename Tree>
+static void timeHinted(const vector<int>& keys, double ns[4], long long& checksum)
+{
+    Tree plain;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i)
+        plain.insert(std::make_pair(keys[i], keys[i]));
+    ns[0] = elapsedNs(start) / keys.size();
+
+    Tree hinted;
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i)
+        hinted.insert(hinted.end(), std::make_pair(keys[i], keys[i]));
+    ns[1] = elapsedNs(start) / keys.size();
+
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i)
+        checksum += plain.find(keys[i])->second;
+    ns[2] = elapsedNs(start) / keys.size();
+
+    const Tree& finger = hinted;
+    typename Tree::iterator it = finger.end();
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        it = finger.find(it, keys[i]);
+        checksum -= it->second;
+    }
+    ns[3] = elapsedNs(start) / keys.size();
+}
+
+static void benchHinted(size_t n)
+{
+    // Timestamps: strictly increasing, and increasing but up to 16 places
+    // out of order.
+    vector<int> sequential(n);
+    for(size_t i = 0; i < n; ++i)
+        sequential[i] = static_cast<int>(i);
+    vector<int> nearSequential(sequential);
+    mt19937 rng(12345);
+    for(size_t i = 0; i < n; i += 16)
+        shuffle(nearSequential.begin() + i, nearSequential.begin() + min(n, i + 16), rng);
+
+    cout << "hinted (" << n << " keys)" << endl;
+    cout << setw(16) << "stream" << setw(14) << "tree" << setw(10) << "insert" << setw(14) << "insert(end)"
+         << setw(10) << "find" << setw(14) << "find(hint)" << "   (ns/op)" << endl;
+    const vector<int>* streams[] = { &sequential, &nearSequential };
+    const char* const streamNames[] = { "sequential", "near-sequential" };
+    for(int s = 0; s < 2; ++s) {
+        double avl[4], rb[4];
+        long long checksum = 0;
+        timeHinted<AVLTree<int, int> >(*streams[s], avl, checksum);
+        timeHinted<RedBlackTree<int, int> >(*streams[s], rb, checksum);
+
+        // std::map has hinted insertion but no finger search.
+        const vector<int>& keys = *streams[s];
+        map<int, int> plain, hinted;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i)
+            plain.insert(std::make_pair(keys[i], keys[i]));
+        double mapNs = elapsedNs(start) / n;
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i)
+            hinted.insert(hinted.end(), std::make_pair(keys[i], keys[i]));
+        double mapHintedNs = elapsedNs(start) / n;
+
+        cout << setw(16) << streamNames[s] << setw(14) << "AVLTree" << fixed << setprecision(1)
+             << setw(10) << avl[0] << setw(14) << avl[1] << setw(10) << avl[2] << setw(14) << avl[3]
+             << (checksum == 0 ? "" : "   checksum mismatch") << endl;
+        cout << setw(16) << "" << setw(14) << "RedBlackTree"
+             << setw(10) << rb[0] << setw(14) << rb[1] << setw(10) << rb[2] << setw(14) << rb[3] << endl;
+        cout << setw(16) << "" << setw(14) << "std::map"
+             << setw(10) << mapNs << setw(14) << mapHintedNs << endl;
+    }
+    cout << endl;
+}
+
+// Looks up n random keys, half of them missing, one find() at a time and
+// through findMany(), on trees growing past the last-level cache.
+static void benchFindMany(size_t maxKeys)
+{
+    cout << "find-many (random keys, half missing)" << endl;
+    cout << setw(12) << "keys" << setw(12) << "find" << setw(12) << "findMany" << "   (ns/op)" << endl;
+    mt19937 rng(12345);
+    for(size_t n = 1 << 16; n <= maxKeys; n *= 4) {
+        vector<int> keys(n);
+        for(size_t i = 0; i < n; ++i)
+            keys[i] = static_cast<int>(2 * i);
+        shuffle(keys.begin(), keys.end(), rng);
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < n; ++i)
+            tree.insert(std::make_pair(keys[i], keys[i]));
+        for(size_t i = 0; i < n; i += 2)
+            keys[i] += 1;
+        shuffle(keys.begin(), keys.end(), rng);
+
+        long long checksum = 0;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            AVLTree<int, int>::iterator it = tree.find(keys[i]);
+            if(it != tree.end())
+                checksum += it->second;
+        }
+        double singleNs = elapsedNs(start) / n;
+
+        vector<AVLTree<int, int>::iterator> found;
+        found.reserve(n);
+        start = Clock::now();
+        tree.findMany(keys.begin(), keys.end(), std::back_inserter(found));
+        for(size_t i = 0; i < n; ++i) {
+            if(found[i] != tree.end())
+                checksum -= found[i]->second;
+        }
+        double manyNs = elapsedNs(start) / n;
+
+        cout << setw(12) << n << fixed << setprecision(1) << setw(12) << singleNs << setw(12) << manyNs
+             << (checksum == 0 ? "" : "   checksum mismatch") << endl;
+    }
+    cout << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    string which = (argc > 1) ? argv[1] : "all";
+    size_t n = (argc > 2) ? strtoul(argv[2], NULL, 10) : 10000000;
+
+    if(which == "avl-insert" || which == "all") {
+        benchAvlInsert(n, false);
+        benchAvlInsert(n, true);
+    }
+    if(which == "avl-clear" || which == "all")
+        benchAvlClear(n);
+    if(which == "bulk-load" || which == "all")
+        benchBulkLoad(n);
+    if(which == "frozen" || which == "all")
+        benchFrozen(n);
+    if(which == "node-layout" || which == "all")
+        benchNodeLayout(n);
+    if(which == "bplus" || which == "all") {
+        benchBPlus<int>(n, "int");
+        benchBPlus<uint64_t>(n, "uint64_t");
+    }
+    if(which == "concurrent" || which == "all")
+        benchConcurrent(n);
+    if(which == "set-ops" || which == "all")
+        benchSetOps(n);
+    if(which == "batch" || which == "all")
+        benchBatch(n);
+    if(which == "snapshot" || which == "all")
+        benchSnapshot(n);
+    if(which == "splay" || which == "all")
+        benchSplay(n);
+    if(which == "red-black" || which == "all")
+        benchRedBlack(n);
+    if(which == "hinted" || which == "all")
+        benchHinted(n);
+    if(which == "find-many" || which == "all")
+        benchFindMany(n);
+    // Not part of "all": the suite prints CSV or JSON rather than a report.
+    if(which == "suite")
+        benchSuite(n, (argc > 3) ? argv[3] : "csv");
+    return 0;
+}
@@ -1,10 +1,85 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <thread>
 #include "bst.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "bplustree.h"
+#include "concurrentavl.h"
+#include "persistentavl.h"
+#include "mappedindex.h"
 
 using namespace std;
 
+// A three-way comparator that orders keys from largest to smallest.
+struct Descending {
+    int operator()(int a, int b) const { return (a < b) - (b < a); }
+};
+
+// Counts the bytes handed out by operator new, so tests can check how much
+// memory an operation allocates.
+static std::atomic<std::size_t> allocatedBytes(0);
+
+void* operator new(std::size_t size)
+{
+    allocatedBytes += size;
+    if(void* p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// Orders ints normally, but throws on the call after the budget runs out.
+struct ThrowingCompare {
+    static long budget;
+    int operator()(int a, int b) const
+    {
+        if(budget-- == 0)
+            throw std::runtime_error("compare budget spent");
+        return (a > b) - (a < b);
+    }
+};
+long ThrowingCompare::budget = -1;
+
+// Checks that tree holds exactly the contents of expected, in order.
+template <typename Tree>
+static bool sameContents(const Tree& tree, const std::map<int,int>& expected)
+{
+    std::map<int,int>::const_iterator want = expected.begin();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++want) {
+        if(want == expected.end() || it->first != want->first || it->second != want->second)
+            return false;
+    }
+    return want == expected.end() && tree.size() == expected.size();
+}
+
+// Bytes allocated by inserting one key below every other into tree.
+template <typename Tree>
+static std::size_t bytesForOneInsert(Tree& tree)
+{
+    std::size_t before = allocatedBytes;
+    tree.insert(std::make_pair(-1L, -1L));
+    return allocatedBytes - before;
+}
 
 int main(int argc, char *argv[])
 {
@@ -31,6 +106,8 @@ int main(int argc, char *argv[])
     at.insert(std::make_pair('a',1));
     at.insert(std::make_pair('b',2));
 
+    at.insert(std::make_pair('c',3));
+
     cout << "\nAVLTree contents:" << endl;
     for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
         cout << it->first << " " << it->second << endl;
@@ -41,8 +118,397 @@ int main(int argc, char *argv[])
     else {
         cout << "Did not find b" << endl;
     }
+    cout << "Keys in [b, d):";
+    AVLTree<char,int>::range_view window = at.range('b', 'd');
+    for(AVLTree<char,int>::iterator it = window.begin(); it != window.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    cout << "Size: " << at.size() << ", rank of c: " << at.rank('c')
+         << ", select(1): " << at.select(1)->first << endl;
+    FrozenIndex<char,int> frozen = at.freeze();
+    cout << "Frozen index has " << frozen.size() << " keys, find c: "
+         << frozen.find('c')->second << endl;
+    AVLTree<char,int> snapshot(at);
     cout << "Erasing b" << endl;
     at.remove('b');
+    cout << "Size: " << at.size() << ", copy size: " << snapshot.size() << endl;
+    AVLTree<char,int> shard;
+    shard.insert(std::make_pair('c',30));
+    shard.insert(std::make_pair('d',4));
+    at.unite(shard);
+    cout << "After unite:";
+    for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << ", shard size: " << shard.size() << endl;
+
+    // A set operation whose Compare throws passes the exception on and
+    // leaves both trees empty but usable.
+    AVLTree<int,int,ThrowingCompare> throwingA, throwingB;
+    for(int i = 0; i < 5000; ++i) {
+        throwingA.insert(std::make_pair(i * 3, i));
+        throwingB.insert(std::make_pair(i * 2, i));
+    }
+    ThrowingCompare::budget = 2000;
+    bool threw = false;
+    try {
+        throwingA.unite(throwingB);
+    }
+    catch(const std::runtime_error&) {
+        threw = true;
+    }
+    ThrowingCompare::budget = -1;
+    assert(threw && throwingA.empty() && throwingB.empty());
+    throwingA.insert(std::make_pair(1, 1));
+    assert(throwingA.size() == 1 && throwingA.isBalanced());
+    cout << "A throwing Compare leaves unite's trees empty" << endl;
+
+    std::vector<std::pair<char,int>> batch = { {'e', 5}, {'b', 2}, {'e', 50} };
+    at.insertBatch(batch.begin(), batch.end());
+    std::vector<char> gone = { 'a', 'z' };
+    at.removeBatch(gone.begin(), gone.end());
+    AVLTree<char,int>::iterator kept = at.find('c');
+    std::vector<std::pair<char,int>> update = { {'c', 300}, {'f', 6} };
+    at.insertBatch(update.begin(), update.end());
+    assert(kept == at.find('c') && kept->second == 300);
+    cout << "After batch:";
+    for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // A bulk load reserves one chunk for the whole tree; the chunks after it
+    // must not be as large.
+    const long bulkKeys = 100000;
+    std::vector<std::pair<long,long>> sortedItems;
+    for(long i = 0; i < bulkKeys; ++i) {
+        sortedItems.push_back(std::make_pair(i, i));
+    }
+    AVLTree<long,long> bulk;
+    bulk.buildFromSorted(sortedItems.begin(), sortedItems.end());
+    std::size_t bulkNodeBytes = bulkKeys * sizeof(AVLNode<long,long>);
+    assert(bytesForOneInsert(bulk) < bulkNodeBytes / 10);
+    cout << "One insert after a bulk load allocates a small chunk" << endl;
+    AVLTree<long,long> copied(bulk);
+    assert(bytesForOneInsert(copied) < bulkNodeBytes / 10);
+    AVLTree<long,long> assigned;
+    assigned = bulk;
+    assert(bytesForOneInsert(assigned) < bulkNodeBytes / 10);
+    cout << "One insert after a copy allocates a small chunk" << endl;
+    bulk.save("bst-test.snapshot");
+    AVLTree<long,long> reloaded;
+    reloaded.load("bst-test.snapshot");
+    std::remove("bst-test.snapshot");
+    assert(reloaded.size() == static_cast<std::size_t>(bulkKeys) + 1);
+    assert(bytesForOneInsert(reloaded) < bulkNodeBytes / 10);
+    cout << "One insert after a load allocates a small chunk" << endl;
+
+    // Red-Black Tree Tests
+    RedBlackTree<char,int> rt;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        rt.insert(std::make_pair(c, c - 'a'));
+    }
+    rt.remove('d');
+    rt.remove('a');
+    cout << "\nRedBlackTree size: " << rt.size() << ", balanced: " << rt.isBalanced() << ", contents:";
+    for(RedBlackTree<char,int>::iterator it = rt.begin(); it != rt.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Bulk-loaded red-black trees are not height balanced, only red-black
+    // valid; removals and inserts must keep them so.
+    std::mt19937 rng(12345);
+    for(int round = 0; round < 100; ++round) {
+        std::map<int,int> expected;
+        std::vector<std::pair<int,int>> items;
+        for(int i = 0; i < 200; ++i) {
+            items.push_back(std::make_pair(i * 2, i));
+            expected[i * 2] = i;
+        }
+        RedBlackTree<int,int> checked;
+        checked.buildFromSorted(items.begin(), items.end());
+        assert(checked.isBalanced());
+        for(int i = 0; i < 150; ++i) {
+            int key = static_cast<int>(rng() % 400);
+            if(rng() % 3 == 0) {
+                checked.insert(std::make_pair(key, -key));
+                expected[key] = -key;
+            }
+            else {
+                checked.remove(key);
+                expected.erase(key);
+            }
+            assert(checked.isBalanced());
+        }
+        assert(sameContents(checked, expected));
+    }
+    cout << "RedBlackTree keeps the red-black rules" << endl;
+
+    // Splay Tree Tests
+    SplayTree<char,int> st;
+    for(char c = 'a'; c <= 'e'; ++c) {
+        st.insert(std::make_pair(c, c - 'a'));
+    }
+    st.find('b');
+    st.remove('d');
+    cout << "\nSplayTree size: " << st.size() << ", found b: " << st['b'] << ", contents:";
+    for(SplayTree<char,int>::iterator it = st.begin(); it != st.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // B+ Tree Tests
+    BPlusTree<int,int> bp;
+    for(int i = 0; i < 100; ++i) {
+        bp.insert(std::make_pair(i * 3, i));
+    }
+    bp.remove(30);
+    cout << "\nBPlusTree size: " << bp.size() << ", find 33: " << bp.find(33)->second
+         << ", find 30: " << (bp.find(30) == bp.end() ? "none" : "found") << endl;
+
+    // Random inserts and removes over a few hundred nodes, then draining the
+    // tree, split, borrow from and merge leaves and inner nodes at every level.
+    BPlusTree<int,int> bpChecked;
+    std::map<int,int> bpExpected;
+    for(int i = 0; i < 40000; ++i) {
+        int key = static_cast<int>(rng() % 4000);
+        if(rng() % 2 == 0) {
+            bpChecked.insert(std::make_pair(key, i));
+            bpExpected[key] = i;
+        }
+        else {
+            bpChecked.remove(key);
+            bpExpected.erase(key);
+        }
+        if(i % 1000 == 0)
+            assert(sameContents(bpChecked, bpExpected));
+    }
+    assert(sameContents(bpChecked, bpExpected));
+    for(int key = 0; key < 4000; ++key) {
+        BPlusTree<int,int>::iterator it = bpChecked.find(key);
+        assert((it == bpChecked.end()) == (bpExpected.count(key) == 0));
+    }
+    while(!bpExpected.empty()) {
+        std::map<int,int>::iterator victim = bpExpected.lower_bound(static_cast<int>(rng() % 4000));
+        if(victim == bpExpected.end())
+            victim = bpExpected.begin();
+        bpChecked.remove(victim->first);
+        bpExpected.erase(victim);
+        if(bpExpected.size() % 100 == 0)
+            assert(sameContents(bpChecked, bpExpected));
+    }
+    assert(bpChecked.empty() && bpChecked.begin() == bpChecked.end());
+    cout << "BPlusTree matches std::map" << endl;
+
+    // Concurrent AVL Tree Tests
+    ConcurrentAVLTree<char,int> ct;
+    ct.insert(std::make_pair('a',1));
+    ct.insert(std::make_pair('b',2));
+    ct.insert(std::make_pair('b',3));
+    int value = 0;
+    bool found = ct.find('b', value);
+    cout << "\nConcurrentAVLTree size: " << ct.size() << ", find b: "
+         << (found ? value : -1) << ", balanced: " << ct.isBalanced() << endl;
+
+    // Writers insert and remove keys from their own residue class while
+    // readers search without locks.  A reader must always find the keys no
+    // writer touches, and any value it finds must belong to its key.
+    const int ctWriters = 4, ctReaders = 2, ctKeys = 2000, ctStable = 500;
+    ConcurrentAVLTree<int,int> ctChecked;
+    for(int key = -ctStable; key < 0; ++key) {
+        ctChecked.insert(std::make_pair(key, key));
+    }
+    std::vector<std::map<int,int> > ctWritten(ctWriters);
+    std::atomic<int> ctWritersLeft(ctWriters);
+    std::vector<std::thread> ctThreads;
+    for(int w = 0; w < ctWriters; ++w) {
+        ctThreads.push_back(std::thread([&, w]() {
+            std::mt19937 local(w);
+            for(int op = 0; op < 5000; ++op) {
+                int key = static_cast<int>(local() % (ctKeys / ctWriters)) * ctWriters + w;
+                if(local() % 2 == 0) {
+                    ctChecked.insert(std::make_pair(key, key + ctKeys * op));
+                    ctWritten[w][key] = key + ctKeys * op;
+                }
+                else {
+                    ctChecked.remove(key);
+                    ctWritten[w].erase(key);
+                }
+            }
+            --ctWritersLeft;
+        }));
+    }
+    for(int r = 0; r < ctReaders; ++r) {
+        ctThreads.push_back(std::thread([&, r]() {
+            std::mt19937 local(ctWriters + r);
+            int found;
+            while(ctWritersLeft > 0) {
+                int key = static_cast<int>(local() % ctKeys);
+                if(ctChecked.find(key, found))
+                    assert(found % ctKeys == key);
+                int stable = -1 - static_cast<int>(local() % ctStable);
+                assert(ctChecked.find(stable, found) && found == stable);
+            }
+        }));
+    }
+    for(std::size_t i = 0; i < ctThreads.size(); ++i) {
+        ctThreads[i].join();
+    }
+    std::map<int,int> ctExpected;
+    for(int key = -ctStable; key < 0; ++key) {
+        ctExpected[key] = key;
+    }
+    for(int w = 0; w < ctWriters; ++w) {
+        ctExpected.insert(ctWritten[w].begin(), ctWritten[w].end());
+    }
+    assert(ctChecked.size() == ctExpected.size() && ctChecked.isBalanced());
+    for(int key = -ctStable; key < ctKeys; ++key) {
+        std::map<int,int>::iterator want = ctExpected.find(key);
+        bool present = ctChecked.find(key, value);
+        assert(present == (want != ctExpected.end()));
+        assert(!present || value == want->second);
+    }
+    cout << "ConcurrentAVLTree matches std::map under concurrent readers and writers" << endl;
+
+    // Persistent AVL Tree Tests
+    PersistentAVLTree<char,int> pt;
+    pt.insert(std::make_pair('a',1));
+    pt.insert(std::make_pair('b',2));
+    PersistentAVLTree<char,int> before = pt.snapshot();
+    pt.insert(std::make_pair('b',20));
+    pt.remove('a');
+    cout << "\nPersistentAVLTree now:";
+    for(PersistentAVLTree<char,int>::iterator it = pt.begin(); it != pt.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << ", snapshot:";
+    for(PersistentAVLTree<char,int>::iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Every snapshot must keep the contents it was taken with while the live
+    // tree, and other snapshots, go on changing.
+    PersistentAVLTree<int,int> ptChecked;
+    std::map<int,int> ptExpected;
+    std::vector<PersistentAVLTree<int,int> > ptSnapshots;
+    std::vector<std::map<int,int> > ptSnapshotExpected;
+    for(int i = 0; i < 20000; ++i) {
+        int key = static_cast<int>(rng() % 2000);
+        if(rng() % 3 != 0) {
+            ptChecked.insert(std::make_pair(key, i));
+            ptExpected[key] = i;
+        }
+        else {
+            ptChecked.remove(key);
+            ptExpected.erase(key);
+        }
+        if(i % 500 == 0) {
+            ptSnapshots.push_back(ptChecked.snapshot());
+            ptSnapshotExpected.push_back(ptExpected);
+        }
+    }
+    assert(sameContents(ptChecked, ptExpected) && ptChecked.isBalanced());
+    for(std::size_t i = 0; i < ptSnapshots.size(); ++i) {
+        assert(sameContents(ptSnapshots[i], ptSnapshotExpected[i]));
+        assert(ptSnapshots[i].isBalanced());
+    }
+    // Writing to a snapshot leaves the live tree and the other snapshots be.
+    PersistentAVLTree<int,int>& branch = ptSnapshots[ptSnapshots.size() / 2];
+    for(int key = 0; key < 2000; key += 7) {
+        branch.remove(key);
+        branch.insert(std::make_pair(key + 1, -key));
+    }
+    assert(sameContents(ptChecked, ptExpected));
+    for(std::size_t i = 0; i < ptSnapshots.size(); ++i) {
+        if(&ptSnapshots[i] != &branch)
+            assert(sameContents(ptSnapshots[i], ptSnapshotExpected[i]));
+    }
+    ptChecked.clear();
+    assert(sameContents(ptSnapshots.back(), ptSnapshotExpected.back()));
+    cout << "PersistentAVLTree snapshots keep their contents" << endl;
+
+    // Snapshot Tests
+    at.save("bst-test.snapshot");
+    AVLTree<char,int> restored;
+    restored.load("bst-test.snapshot");
+    MappedIndex<char,int> mapped("bst-test.snapshot");
+    cout << "\nRestored:";
+    for(AVLTree<char,int>::iterator it = restored.begin(); it != restored.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << ", mapped find e: " << *mapped.find('e') << endl;
+    std::remove("bst-test.snapshot");
+
+    // Comparator Tests
+    AVLTree<std::string,int> words;
+    words.insert(std::make_pair(std::string("apple"), 1));
+    words.insert(std::make_pair(std::string("pear"), 2));
+    std::string_view query = "pear";
+    cout << "\nFound " << query << ": " << words.find(query)->second;
+    AVLTree<int,int,Descending> descending;
+    for(int i = 1; i <= 4; ++i) {
+        descending.insert(std::make_pair(i, i * i));
+    }
+    cout << ", descending:";
+    for(AVLTree<int,int,Descending>::iterator it = descending.begin(); it != descending.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    // The other tree variants order by Compare too; the B+ tree must leave
+    // its integer vector search for the comparator.
+    BPlusTree<int,int,Descending> bpDescending;
+    PersistentAVLTree<int,int,Descending> ptDescending;
+    ConcurrentAVLTree<int,int,Descending> ctDescending;
+    for(int i = 0; i < 100; ++i) {
+        bpDescending.insert(std::make_pair(i, i));
+        ptDescending.insert(std::make_pair(i, i));
+        ctDescending.insert(std::make_pair(i, i));
+    }
+    assert(!(BPlusTree<int,int,Descending>::SIMD_NODE_SEARCH));
+    int expected = 99;
+    for(BPlusTree<int,int,Descending>::iterator it = bpDescending.begin(); it != bpDescending.end(); ++it) {
+        assert(it->first == expected--);
+    }
+    assert(expected == -1);
+    expected = 99;
+    for(PersistentAVLTree<int,int,Descending>::iterator it = ptDescending.begin(); it != ptDescending.end(); ++it) {
+        assert(it->first == expected--);
+    }
+    assert(expected == -1);
+    for(int i = 0; i < 100; ++i) {
+        assert(bpDescending.find(i)->second == i);
+        assert(ptDescending.find(i)->second == i);
+        assert(ctDescending.contains(i));
+    }
+    assert(ctDescending.isBalanced() && ptDescending.isBalanced());
+
+    // Hinted Insertion Tests
+    AVLTree<int,int> stamps;
+    for(int i = 0; i < 8; ++i) {
+        stamps.insert(stamps.end(), std::make_pair(i * 10, i));
+    }
+    AVLTree<int,int>::iterator near = stamps.find(stamps.end(), 30);
+    cout << "Hinted find 30: " << near->second;
+    cout << ", find 40 from 30: " << stamps.find(near, 40)->second;
+    cout << ", balanced: " << stamps.isBalanced() << endl;
+
+    // Batched Lookup Tests
+    vector<int> wanted = { 70, 5, 0, 40 };
+    vector<AVLTree<int,int>::iterator> hits;
+    stamps.findMany(wanted.begin(), wanted.end(), std::back_inserter(hits));
+    cout << "findMany:";
+    for(size_t i = 0; i < hits.size(); ++i) {
+        if(hits[i] != stamps.end()) {
+            cout << " " << hits[i]->second;
+        }
+        else {
+            cout << " missing";
+        }
+    }
+    cout << endl;
 
     return 0;
 }
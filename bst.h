@@ -7,18 +7,78 @@
 #include <utility>
 #include <algorithm>  // for std::max
 #include <cmath>      // for std::abs
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include "keycompare.h"
+#include "frozenbst.h"
+#include "snapshotbst.h"
+
+/**
+ * Builds the key/value pair stored in a new node.  make() returns the pair by
+ * value, so with C++17's guaranteed copy elision the pair is constructed
+ * directly inside the node that calls it, with no intermediate copy or move.
+ * This lets the tree construct nodes of its own node type from arguments that
+ * were forwarded through a virtual call.
+ */
+template <typename Key, typename Value>
+class ItemFactory {
+public:
+    virtual std::pair<const Key, Value> make() = 0;
+
+protected:
+    ~ItemFactory() {}
+};
+
+/**
+ * An ItemFactory that constructs the pair from a pack of forwarded
+ * arguments, as std::pair's own constructors would.  It holds references, so
+ * it must not outlive the arguments, and make() may only be called once.
+ */
+template <typename Key, typename Value, typename... Args>
+class ForwardingItemFactory : public ItemFactory<Key, Value> {
+public:
+    explicit ForwardingItemFactory(Args&&... args);
+    virtual std::pair<const Key, Value> make();
+
+private:
+    std::tuple<Args&&...> args_;
+};
+
+template<typename Key, typename Value, typename... Args>
+ForwardingItemFactory<Key, Value, Args...>::ForwardingItemFactory(Args&&... args) :
+    args_(std::forward<Args>(args)...)
+{}
+
+template<typename Key, typename Value, typename... Args>
+std::pair<const Key, Value> ForwardingItemFactory<Key, Value, Args...>::make() {
+    return std::make_from_tuple<std::pair<const Key, Value> >(std::move(args_));
+}
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so that they can be
- * overridden for future kinds of search trees, such as Red Black trees,
- * Splay trees, and AVL trees.
+ * The getters for parent/left/right are not virtual: node types for other
+ * kinds of search trees, such as Red Black trees, Splay trees, and AVL trees,
+ * derive from Node and hide them with versions returning their own type.
+ * This keeps every traversal step a direct, inlinable load and leaves nodes
+ * without a vtable pointer.
+ *
+ * Nodes are at least pointer-aligned, so the low bits of a parent pointer
+ * are always zero.  Subclasses may keep a few bits of their own there
+ * (RedBlackNode keeps its color) through getTag/setTag: getParent masks
+ * them off and setParent leaves them alone.
  */
 template <typename Key, typename Value>
 class Node {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(ItemFactory<Key, Value>& item, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,18 +86,23 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
+    static const std::uintptr_t TAG_MASK = alignof(void*) - 1;
+    std::uintptr_t getTag() const;
+    void setTag(std::uintptr_t tag);
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
+    std::uintptr_t parent_;     // parent pointer | tag bits
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
 };
@@ -50,7 +115,15 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
-    parent_(parent),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+{}
+
+template<typename Key, typename Value>
+Node<Key, Value>::Node(ItemFactory<Key, Value>& item, Node<Key, Value>* parent) :
+    item_(item.make()),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
     left_(NULL),
     right_(NULL)
 {}
@@ -85,7 +158,7 @@ Value& Node<Key, Value>::getValue() {
 
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const {
-    return parent_;
+    return reinterpret_cast<Node<Key, Value>*>(parent_ & ~TAG_MASK);
 }
 
 template<typename Key, typename Value>
@@ -100,7 +173,7 @@ Node<Key, Value>* Node<Key, Value>::getRight() const {
 
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent) {
-    parent_ = parent;
+    parent_ = reinterpret_cast<std::uintptr_t>(parent) | (parent_ & TAG_MASK);
 }
 
 template<typename Key, typename Value>
@@ -113,11 +186,26 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right) {
     right_ = right;
 }
 
+template<typename Key, typename Value>
+std::uintptr_t Node<Key, Value>::getTag() const {
+    return parent_ & TAG_MASK;
+}
+
+template<typename Key, typename Value>
+void Node<Key, Value>::setTag(std::uintptr_t tag) {
+    parent_ = (parent_ & ~TAG_MASK) | tag;
+}
+
 template<typename Key, typename Value>
 void Node<Key, Value>::setValue(const Value& value) {
     item_.second = value;
 }
 
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value) {
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -125,22 +213,277 @@ void Node<Key, Value>::setValue(const Value& value) {
 */
 
 /**
- * A templated unbalanced binary search tree.
+ * A slab allocator for tree nodes of a single size.
+ * Slots are carved out of contiguous chunks that grow geometrically, and
+ * freed slots are kept on an intrusive free list for reuse.  release()
+ * gives every chunk back at once without touching individual nodes.
  */
-template <typename Key, typename Value>
+class NodePool {
+public:
+    NodePool(std::size_t slotSize, std::size_t slotAlign);
+    NodePool(NodePool&& other);
+    ~NodePool();
+
+    // Exchanges the memory of two pools with the same slot size.
+    void swap(NodePool& other);
+
+    void* allocate();
+    void deallocate(void* slot);
+    void release();
+    // Makes the next count allocations come from one contiguous run.
+    void reserve(std::size_t count);
+    // Takes over all of other's memory (other must have the same slot
+    // size).  Slots other handed out stay valid and are now returned here.
+    void splice(NodePool& other);
+
+private:
+    // Pools own raw memory, so they can be moved but not copied.
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    void addChunk();
+
+    struct FreeSlot { FreeSlot* next; };
+    struct Chunk { Chunk* next; };
+
+    static const std::size_t FIRST_CHUNK_SLOTS = 32;
+    static const std::size_t MAX_CHUNK_BYTES = 1 << 20;
+
+    std::size_t slotSize_;
+    std::size_t headerSize_;
+    std::size_t chunkSlots_;
+    Chunk* chunks_;
+    char* cursor_;
+    char* chunkEnd_;
+    FreeSlot* freeList_;
+};
+
+/*
+  ------------------------------------------
+  Begin implementations for the NodePool class.
+  ------------------------------------------
+*/
+inline NodePool::NodePool(std::size_t slotSize, std::size_t slotAlign) :
+    slotSize_(0),
+    headerSize_(0),
+    chunkSlots_(FIRST_CHUNK_SLOTS),
+    chunks_(nullptr),
+    cursor_(nullptr),
+    chunkEnd_(nullptr),
+    freeList_(nullptr)
+{
+    // Every slot must be able to hold a free-list link and stay aligned.
+    std::size_t align = std::max(slotAlign, alignof(FreeSlot));
+    std::size_t size = std::max(slotSize, sizeof(FreeSlot));
+    slotSize_ = (size + align - 1) / align * align;
+    headerSize_ = (sizeof(Chunk) + align - 1) / align * align;
+}
+
+inline NodePool::NodePool(NodePool&& other) :
+    slotSize_(other.slotSize_),
+    headerSize_(other.headerSize_),
+    chunkSlots_(FIRST_CHUNK_SLOTS),
+    chunks_(nullptr),
+    cursor_(nullptr),
+    chunkEnd_(nullptr),
+    freeList_(nullptr)
+{
+    swap(other);
+}
+
+inline NodePool::~NodePool() {
+    release();
+}
+
+inline void NodePool::swap(NodePool& other) {
+    std::swap(slotSize_, other.slotSize_);
+    std::swap(headerSize_, other.headerSize_);
+    std::swap(chunkSlots_, other.chunkSlots_);
+    std::swap(chunks_, other.chunks_);
+    std::swap(cursor_, other.cursor_);
+    std::swap(chunkEnd_, other.chunkEnd_);
+    std::swap(freeList_, other.freeList_);
+}
+
+inline void* NodePool::allocate() {
+    if(freeList_ != nullptr) {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+    if(cursor_ == chunkEnd_)
+        addChunk();
+    void* slot = cursor_;
+    cursor_ += slotSize_;
+    return slot;
+}
+
+inline void NodePool::deallocate(void* slot) {
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+inline void NodePool::release() {
+    while(chunks_ != nullptr) {
+        Chunk* next = chunks_->next;
+        ::operator delete(chunks_);
+        chunks_ = next;
+    }
+    chunkSlots_ = FIRST_CHUNK_SLOTS;
+    cursor_ = chunkEnd_ = nullptr;
+    freeList_ = nullptr;
+}
+
+inline void NodePool::reserve(std::size_t count) {
+    std::size_t available = static_cast<std::size_t>(chunkEnd_ - cursor_) / slotSize_;
+    if(count <= available)
+        return;
+    if(count <= chunkSlots_) {
+        addChunk();
+        return;
+    }
+    // One oversized chunk for this run only: the chunks after it keep the
+    // usual sizes instead of each being as large as the reservation.
+    std::size_t scheduled = chunkSlots_;
+    chunkSlots_ = count;
+    addChunk();
+    chunkSlots_ = scheduled;
+}
+
+inline void NodePool::splice(NodePool& other) {
+    // Slots other never handed out, loose or in its current chunk, join
+    // this pool's free list.
+    while(other.freeList_ != nullptr) {
+        FreeSlot* slot = other.freeList_;
+        other.freeList_ = slot->next;
+        deallocate(slot);
+    }
+    for(; other.cursor_ != other.chunkEnd_; other.cursor_ += slotSize_)
+        deallocate(other.cursor_);
+    if(other.chunks_ != nullptr) {
+        Chunk* tail = other.chunks_;
+        while(tail->next != nullptr)
+            tail = tail->next;
+        tail->next = chunks_;
+        chunks_ = other.chunks_;
+    }
+    other.chunks_ = nullptr;
+    other.cursor_ = other.chunkEnd_ = nullptr;
+    other.chunkSlots_ = FIRST_CHUNK_SLOTS;
+}
+
+inline void NodePool::addChunk() {
+    char* raw = static_cast<char*>(::operator new(headerSize_ + chunkSlots_ * slotSize_));
+    Chunk* chunk = reinterpret_cast<Chunk*>(raw);
+    chunk->next = chunks_;
+    chunks_ = chunk;
+    cursor_ = raw + headerSize_;
+    chunkEnd_ = cursor_ + chunkSlots_ * slotSize_;
+    if(chunkSlots_ * slotSize_ < MAX_CHUNK_BYTES)
+        chunkSlots_ *= 2;
+}
+
+/*
+  ----------------------------------------
+  End implementations for the NodePool class.
+  ----------------------------------------
+*/
+
+#if defined(__GNUC__)
+#define BST_NOINLINE __attribute__((noinline))
+#else
+#define BST_NOINLINE
+#endif
+
+/**
+ * A snapshot of a tree's operation counters, as returned by stats().  The
+ * counters are only kept when BST_STATS is defined; without it they cost
+ * nothing and stats() reports zeros.
+ */
+struct TreeStats {
+    uint64_t comparisons;       // key comparisons made while searching
+    uint64_t searches;          // descents from the root: finds, bounds, insert slots
+    uint64_t totalSearchDepth;  // nodes visited by all searches
+    uint64_t maxSearchDepth;    // most nodes visited by one search
+    uint64_t singleRotations;   // AVL/red-black rebalances needing one rotation
+    uint64_t doubleRotations;   // and needing two
+    uint64_t nodeSwaps;
+    uint64_t allocations;       // nodes constructed
+
+    double averageSearchDepth() const {
+        return (searches == 0) ? 0.0 : static_cast<double>(totalSearchDepth) / searches;
+    }
+};
+
+#ifdef BST_STATS
+/**
+ * The live counters behind TreeStats.  Const searches update them too, so
+ * each is an atomic bumped with a relaxed load and store rather than a
+ * locked add: concurrent readers of one tree may lose a count, but nothing
+ * races, and a single thread pays for no more than a plain increment.
+ */
+struct TreeStatCounters {
+    struct Counter {
+        Counter() : value(0) {}
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+        void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+        void add(uint64_t n) { set(get() + n); }
+
+        std::atomic<uint64_t> value;
+    };
+
+    Counter comparisons;
+    Counter searches;
+    Counter totalSearchDepth;
+    Counter maxSearchDepth;
+    Counter singleRotations;
+    Counter doubleRotations;
+    Counter nodeSwaps;
+    Counter allocations;
+};
+#endif
+
+/**
+ * A templated unbalanced binary search tree.  Keys are ordered by the
+ * three-way comparator Compare (see keycompare.h), called once per node a
+ * search visits.  When Compare is transparent, find() and the bounded
+ * lookups also accept any type it can compare with Key.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
 class BinarySearchTree {
 public:
     BinarySearchTree();                   // constructor
+    BinarySearchTree(const BinarySearchTree& other);    // O(n) structural copy
+    BinarySearchTree(BinarySearchTree&& other);         // steals other's nodes
     virtual ~BinarySearchTree();          // destructor
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    BinarySearchTree& operator=(BinarySearchTree other);
+    // Inserts the pair, overwriting the value if the key is already present.
+    // Subclasses customize insertion through allocateNode/insertFix below,
+    // which every insertion path goes through.
+    void insert(const std::pair<const Key, Value>& keyValuePair);
     virtual void remove(const Key& key);
+
     void clear();
+    // Replaces the contents with the key/value pairs in [first, last), which
+    // must be in strictly increasing key order, building a balanced tree in
+    // O(n).  Throws std::invalid_argument if the keys are out of order; then,
+    // or if copying an item throws, the tree is left untouched.
+    template<typename ForwardIt>
+    void buildFromSorted(ForwardIt first, ForwardIt last);
     bool isBalanced() const;
     void print() const;
     bool empty() const;
+    std::size_t size() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    // Operation counters since construction or the last resetStats(), all
+    // zero unless BST_STATS is defined.  They stay with the tree object
+    // when contents are moved or swapped.
+    TreeStats stats() const;
+    void resetStats();
+
+    template<typename PPKey, typename PPValue, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare> & tree);
 
 public:
     /**
@@ -160,21 +503,127 @@ public:
         iterator& operator++();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Compare>;
         Node<Key, Value>* current_;
     };
 
+    /**
+    * A view over the keys in [first, last) of a tree, iterated with the
+    * tree's iterator.
+    */
+    class range_view {
+    public:
+        range_view(iterator first, iterator last);
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
 public:
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+
+    // Exports the current contents into a read-only, cache-friendly index
+    // (see frozenbst.h).  Later changes to the tree do not affect it.
+    FrozenIndex<Key, Value, Compare> freeze() const;
+
+    // Writes the contents to path in key order, and replaces the contents
+    // with those of a file written by save() (see snapshotbst.h for the
+    // format).  Both throw std::runtime_error on failure; a failed load
+    // leaves the tree untouched and a failed save leaves path as it was.
+    // Snapshots of trivially copyable types can also be searched in place
+    // with MappedIndex (mappedindex.h, POSIX only).
+    void save(const std::string& path) const;
+    void load(const std::string& path);
+
+    // Bounded lookups: O(log n) to position, then O(1) amortized per step.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    range_view range(const Key& lo, const Key& hi) const;   // keys in [lo, hi)
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+
+    // Move-aware insertion.  Like std::map, each returns an iterator to the
+    // element with the key and whether a new node was created; keys and values
+    // are constructed directly inside the node from the forwarded arguments.
+    // insert() of a pair-like rvalue keeps insert's overwrite semantics and
+    // is insert_or_assign of its members; emplace/try_emplace leave an
+    // existing value alone.
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    std::pair<iterator, bool> insert(P&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+    // The non-const versions insert a default-constructed value for a
+    // missing key; the const version throws std::out_of_range.
     Value& operator[](const Key& key);
+    Value& operator[](Key&& key);
     Value const & operator[](const Key& key) const;
 
+    // Hinted insertion and finger search.  The search starts at hint rather
+    // than at the root, climbing by parent pointers only until key is within
+    // the subtree below and then descending, so a key near hint costs a few
+    // comparisons whatever the size of the tree.  A hint of end() starts at
+    // the largest key, which the tree keeps cached: appending a key larger
+    // than every other costs one comparison before rebalancing.  Like
+    // insert(), the hinted insert overwrites the value of a present key; it
+    // returns an iterator to the key's element.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator find(iterator hint, const Key& key) const;
+
+    // Looks up every key in [first, last) and writes one iterator per key,
+    // in order, to out (end() for a missing key); returns the advanced out.
+    // Lookups run in groups of FIND_GROUP that descend one level at a time
+    // in lockstep, prefetching each next node, so the cache misses of a
+    // group overlap instead of following one another.  Worth it once the
+    // tree no longer fits in cache; the SplayTree does not splay here.
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt findMany(ForwardIt first, ForwardIt last, OutputIt out) const;
+
 protected:
-    // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const;
+    // Nodes have no virtual destructor, so each tree records how to destroy
+    // the node type it allocates.
+    typedef void (*NodeDestructor)(Node<Key, Value>*);
+    template<typename NodeType>
+    static void destructNode(Node<Key, Value>* node);
+
+    // Constructor for subclasses whose nodes are larger than Node.
+    BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign, NodeDestructor destruct);
+
+    // Construct a node in a slot from pool_, and give a node's slot back.
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    void destroyNode(Node<Key, Value>* node);
+
+    // Mandatory helper functions.  The searches take any key type Compare
+    // accepts.
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const;
+    template<typename K>
+    Node<Key, Value>* internalLowerBound(const K& k) const;
+    template<typename K>
+    Node<Key, Value>* internalUpperBound(const K& k) const;
     Node<Key, Value>* getSmallestNode() const;
+    Node<Key, Value>* getLargestNode() const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current);
     // Static successor function for the iterator.
     static Node<Key, Value>* successor(Node<Key, Value>* current) {
@@ -197,14 +646,79 @@ protected:
     virtual void printRoot(Node<Key, Value>* r) const;
     virtual void nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2);
 
-    // Helper for clear()
-    void clearHelper(Node<Key, Value>* node);
+    // Helpers for clear(): run the node destructors in bounded stack space.
+    // destroyByRotation is kept out of line so that compilers still inline
+    // several levels of clearHelper's recursion.
+    static const int CLEAR_MAX_DEPTH = 64;
+    void clearHelper(Node<Key, Value>* node, int depthLeft);
+    BST_NOINLINE void destroyByRotation(Node<Key, Value>* node);
+
+    // Lookups findMany() keeps in flight: enough misses to cover memory
+    // latency, few enough that the group's state stays in registers and L1.
+    static const std::size_t FIND_GROUP = 16;
+
+    // Helpers for copying and moving.  cloneFrom copies other's comparator
+    // and shape into this (empty) tree in O(n) without any rebalancing,
+    // making each node with cloneNode so subclasses can carry their balance
+    // data over.
+    // swap exchanges the contents of two trees of the same type.
+    void cloneFrom(const BinarySearchTree& other);
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* source, Node<Key, Value>* parent);
+    void swap(BinarySearchTree& other);
+
+    // Helpers for buildFromSorted().  buildSubtree consumes n items in order
+    // and returns the root of a subtree whose left side gets n/2 of them,
+    // levelsBelow levels above the bottom level of the whole tree (every
+    // empty child in the result is on the bottom level or the one below).
+    // createBuiltNode makes the node for one item once the sizes of its
+    // subtrees are known, so subclasses can fill in their balance data.
+    template<typename ForwardIt>
+    Node<Key, Value>* buildSubtree(ForwardIt& it, std::size_t n, int levelsBelow);
+    virtual Node<Key, Value>* createBuiltNode(ItemFactory<Key, Value>& item,
+                                              std::size_t leftCount, std::size_t rightCount,
+                                              int levelsBelow);
+
+    // Insertion machinery shared by insert/emplace/try_emplace/insert_or_assign.
+    // findSlot returns the node holding key, or nullptr with parent set to the
+    // node a new key would hang from (nullptr for an empty tree).  allocateNode
+    // constructs a node of the tree's node type, and linkNode attaches it under
+    // parent and calls insertFix, which subclasses override to rebalance.
+    // Trees that restructure on every access (SplayTree) override findSlot
+    // and linkNode themselves.
+    virtual Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>*& parent);
+    virtual Node<Key, Value>* allocateNode(ItemFactory<Key, Value>& item, Node<Key, Value>* parent);
+    virtual void linkNode(Node<Key, Value>* node, Node<Key, Value>* parent);
+    virtual void insertFix(Node<Key, Value>* node);
+    // findSlotNear is findSlot for hinted insertion, searching from hint
+    // (nullptr for end()) with fingerSearch.
+    virtual Node<Key, Value>* findSlotNear(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent);
+    template<typename K>
+    Node<Key, Value>* fingerSearch(Node<Key, Value>* start, const K& key, Node<Key, Value>*& parent) const;
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceHelper(K&& key, Args&&... args);
 
     // Helper for isBalanced()
     int isBalancedHelper(Node<Key, Value>* node) const;
 
+    // Statistics hooks; no-ops without BST_STATS.
+    void recordSearch(std::size_t depth, std::size_t comparisons) const;
+    void recordRotation(bool isDouble);
+    void recordNodeSwap();
+    void recordAllocation();
+
 protected:
     Node<Key, Value>* root_;
+    NodePool pool_;
+    NodeDestructor destruct_;
+    std::size_t size_;
+    Compare compare_;
+    // The largest node, or nullptr if not yet found again since it was
+    // removed; see getLargestNode().  Only linkNode() and destroyNode()
+    // keep it up to date, so anything else that adds nodes resets it.
+    mutable Node<Key, Value>* rightmost_;
+#ifdef BST_STATS
+    mutable TreeStatCounters stats_;
+#endif
 };
 
 /*
@@ -212,40 +726,40 @@ protected:
 Begin implementations for the BinarySearchTree::iterator class.
 --------------------------------------------------------------
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value>* ptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value>* ptr)
     : current_(ptr)
 {}
 
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator()
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator()
     : current_(nullptr)
 {}
 
-template<class Key, class Value>
-std::pair<const Key,Value>& BinarySearchTree<Key, Value>::iterator::operator*() const {
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>& BinarySearchTree<Key, Value, Compare>::iterator::operator*() const {
     return current_->getItem();
 }
 
-template<class Key, class Value>
-std::pair<const Key,Value>* BinarySearchTree<Key, Value>::iterator::operator->() const {
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>* BinarySearchTree<Key, Value, Compare>::iterator::operator->() const {
     return &(current_->getItem());
 }
 
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::iterator::operator==(const iterator& rhs) const {
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const {
     return current_ == rhs.current_;
 }
 
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::iterator::operator!=(const iterator& rhs) const {
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const {
     return current_ != rhs.current_;
 }
 
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++() {
-    current_ = BinarySearchTree<Key, Value>::successor(current_);
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator++() {
+    current_ = BinarySearchTree<Key, Value, Compare>::successor(current_);
     return *this;
 }
 
@@ -255,79 +769,361 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+----------------------------------------------------------------
+Begin implementations for the BinarySearchTree::range_view class.
+----------------------------------------------------------------
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::range_view::range_view(iterator first, iterator last)
+    : first_(first), last_(last)
+{}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::range_view::begin() const {
+    return first_;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::range_view::end() const {
+    return last_;
+}
+
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::range_view::empty() const {
+    return first_ == last_;
+}
+
+/*
+--------------------------------------------------------------
+End implementations for the BinarySearchTree::range_view class.
+--------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
 -----------------------------------------------------
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree()
-    : root_(nullptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree()
+    : root_(nullptr),
+      pool_(sizeof(Node<Key, Value>), alignof(Node<Key, Value>)),
+      destruct_(&destructNode<Node<Key, Value> >),
+      size_(0),
+      rightmost_(nullptr)
+{}
+
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign, NodeDestructor destruct)
+    : root_(nullptr), pool_(nodeSize, nodeAlign), destruct_(destruct), size_(0), rightmost_(nullptr)
 {}
 
-template<typename Key, class Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree() {
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const BinarySearchTree& other)
+    : BinarySearchTree()
+{
+    static_assert(std::is_copy_constructible<Value>::value, "copying a tree needs a copyable Value");
+    cloneFrom(other);
+}
+
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(BinarySearchTree&& other)
+    : root_(other.root_),
+      pool_(std::move(other.pool_)),
+      destruct_(other.destruct_),
+      size_(other.size_),
+      compare_(other.compare_),
+      rightmost_(other.rightmost_)
+{
+    other.root_ = nullptr;
+    other.size_ = 0;
+    other.rightmost_ = nullptr;
+}
+
+template<typename Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree() {
     clear();
 }
 
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const {
+// Copy-and-swap: other is already a copy (or the moved-from original).
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>& BinarySearchTree<Key, Value, Compare>::operator=(BinarySearchTree other) {
+    swap(other);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const {
     return root_ == nullptr;
 }
 
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const {
+template<class Key, class Value, class Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::size() const {
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin() const {
     return iterator(getSmallestNode());
 }
 
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const {
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end() const {
     return iterator(nullptr);
 }
 
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key& key) const {
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key& key) const {
     return iterator(internalFind(key));
 }
 
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key) {
-    Node<Key, Value>* curr = internalFind(key);
-    if(curr == nullptr) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& key) const {
+    return iterator(internalFind(key));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(iterator hint, const Key& key) const {
+    Node<Key, Value>* start = (hint.current_ != nullptr) ? hint.current_ : getLargestNode();
+    if(start == nullptr)
+        return end();
+    Node<Key, Value>* parent;
+    return iterator(fingerSearch(start, key, parent));
+}
+
+// Each pass over the group does one comparison per unfinished lookup and
+// prefetches the child it moves to; by the time the pass comes back to a
+// lookup, its node has had a whole pass to arrive.
+template<class Key, class Value, class Compare>
+template<typename ForwardIt, typename OutputIt>
+OutputIt BinarySearchTree<Key, Value, Compare>::findMany(ForwardIt first, ForwardIt last, OutputIt out) const {
+    ForwardIt keys[FIND_GROUP];
+    Node<Key, Value>* current[FIND_GROUP];
+    Node<Key, Value>* found[FIND_GROUP];
+    std::size_t depth[FIND_GROUP];
+    while(first != last) {
+        std::size_t count = 0;
+        for(; count < FIND_GROUP && first != last; ++count, ++first) {
+            keys[count] = first;
+            current[count] = root_;
+            found[count] = nullptr;
+            depth[count] = 0;
+        }
+        for(bool active = (root_ != nullptr); active; ) {
+            active = false;
+            for(std::size_t i = 0; i < count; ++i) {
+                Node<Key, Value>* node = current[i];
+                if(node == nullptr)
+                    continue;
+                ++depth[i];
+                int order = compare_(*keys[i], node->getKey());
+                if(order == 0) {
+                    found[i] = node;
+                    current[i] = nullptr;
+                    continue;
+                }
+                node = (order < 0) ? node->getLeft() : node->getRight();
+                current[i] = node;
+                if(node != nullptr) {
+#if defined(__GNUC__)
+                    __builtin_prefetch(node);
+#endif
+                    active = true;
+                }
+            }
+        }
+        for(std::size_t i = 0; i < count; ++i) {
+            recordSearch(depth[i], depth[i]);
+            *out = iterator(found[i]);
+            ++out;
+        }
+    }
+    return out;
+}
+
+template<class Key, class Value, class Compare>
+FrozenIndex<Key, Value, Compare> BinarySearchTree<Key, Value, Compare>::freeze() const {
+    return FrozenIndex<Key, Value, Compare>(begin(), end());
 }
 
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const {
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::save(const std::string& path) const {
+    writeSnapshot<Key, Value>(path, begin(), end(), size_);
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::load(const std::string& path) {
+    std::vector<std::pair<Key, Value> > items = readSnapshot<Key, Value>(path, compare_);
+    buildFromSorted(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& key) const {
+    return iterator(internalLowerBound(key));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& key) const {
+    return iterator(internalUpperBound(key));
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K& key) const {
+    return iterator(internalLowerBound(key));
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K& key) const {
+    return iterator(internalUpperBound(key));
+}
+
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& key) const {
+    Node<Key, Value>* first = internalLowerBound(key);
+    if(first != nullptr && compare_(key, first->getKey()) == 0)
+        return std::make_pair(iterator(first), iterator(successor(first)));
+    return std::make_pair(iterator(first), iterator(first));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::range_view
+BinarySearchTree<Key, Value, Compare>::range(const Key& lo, const Key& hi) const {
+    if(compare_(lo, hi) >= 0)
+        return range_view(end(), end());
+    return range_view(lower_bound(lo), lower_bound(hi));
+}
+
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) {
+    return tryEmplaceHelper(key).first->second;
+}
+
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](Key&& key) {
+    return tryEmplaceHelper(std::move(key)).first->second;
+}
+
+template<class Key, class Value, class Compare>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) const {
     Node<Key, Value>* curr = internalFind(key);
     if(curr == nullptr) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
+template<class Key, class Value, class Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(Args&&... args) {
+    void* slot = pool_.allocate();
+    recordAllocation();
+    try {
+        return new (slot) NodeType(std::forward<Args>(args)...);
+    }
+    catch(...) {
+        pool_.deallocate(slot);
+        throw;
+    }
+}
+
+template<class Key, class Value, class Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::destructNode(Node<Key, Value>* node) {
+    static_cast<NodeType*>(node)->~NodeType();
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(Node<Key, Value>* node) {
+    if(node == rightmost_)
+        rightmost_ = nullptr;
+    destruct_(node);
+    pool_.deallocate(node);
+}
+
 /* 
 -----------------------------------------------------
 Mandatory Helper Functions (Definitions)
 -----------------------------------------------------
 */
-template<typename Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const {
+// Each node visited costs one comparison, so depth also counts those for
+// recordSearch(); without BST_STATS the compiler drops it.
+template<typename Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const K& key) const {
     Node<Key, Value>* current = root_;
+    std::size_t depth = 0;
     while(current != nullptr) {
-        if(key < current->getKey())
+        ++depth;
+        int order = compare_(key, current->getKey());
+        if(order < 0)
             current = current->getLeft();
-        else if (current->getKey() < key)
+        else if(order > 0)
             current = current->getRight();
-        else
+        else {
+            recordSearch(depth, depth);
             return current;
+        }
     }
+    recordSearch(depth, depth);
     return nullptr;
 }
 
-template<typename Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::getSmallestNode() const {
+// Returns the node with the smallest key not less than k, or nullptr.
+template<typename Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalLowerBound(const K& key) const {
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* bound = nullptr;
+    std::size_t depth = 0;
+    while(current != nullptr) {
+        ++depth;
+        if(compare_(current->getKey(), key) < 0)
+            current = current->getRight();
+        else {
+            bound = current;
+            current = current->getLeft();
+        }
+    }
+    recordSearch(depth, depth);
+    return bound;
+}
+
+// Returns the node with the smallest key greater than k, or nullptr.
+template<typename Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalUpperBound(const K& key) const {
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* bound = nullptr;
+    std::size_t depth = 0;
+    while(current != nullptr) {
+        ++depth;
+        if(compare_(key, current->getKey()) < 0) {
+            bound = current;
+            current = current->getLeft();
+        }
+        else
+            current = current->getRight();
+    }
+    recordSearch(depth, depth);
+    return bound;
+}
+
+template<typename Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::getSmallestNode() const {
     Node<Key, Value>* current = root_;
     if(current == nullptr) return nullptr;
     while(current->getLeft() != nullptr)
@@ -335,8 +1131,20 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::getSmallestNode() const {
     return current;
 }
 
-template<typename Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current) {
+// Walks down the right spine only when the cached node has been removed.
+template<typename Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::getLargestNode() const {
+    if(rightmost_ == nullptr && root_ != nullptr) {
+        Node<Key, Value>* current = root_;
+        while(current->getRight() != nullptr)
+            current = current->getRight();
+        rightmost_ = current;
+    }
+    return rightmost_;
+}
+
+template<typename Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current) {
     if (!current) return nullptr;
     if(current->getLeft() != nullptr) {
         current = current->getLeft();
@@ -357,33 +1165,229 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* cu
 Core BST Functions: insert, remove, clear, isBalanced
 -----------------------------------------------------
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair) {
-    if (root_ == nullptr) {
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair) {
+    Node<Key, Value>* parent;
+    Node<Key, Value>* existing = findSlot(keyValuePair.first, parent);
+    if(existing != nullptr) {
+        existing->setValue(keyValuePair.second);
         return;
     }
-    Node<Key, Value>* parent = nullptr;
+    ForwardingItemFactory<Key, Value, const std::pair<const Key, Value>&> item(keyValuePair);
+    linkNode(allocateNode(item, parent), parent);
+}
+
+template<class Key, class Value, class Compare>
+template<typename P, typename>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert(P&& keyValuePair) {
+    return insert_or_assign(std::get<0>(std::forward<P>(keyValuePair)),
+                            std::get<1>(std::forward<P>(keyValuePair)));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair) {
+    Node<Key, Value>* parent;
+    Node<Key, Value>* existing = findSlotNear(hint.current_, keyValuePair.first, parent);
+    if(existing != nullptr) {
+        existing->setValue(keyValuePair.second);
+        return iterator(existing);
+    }
+    ForwardingItemFactory<Key, Value, const std::pair<const Key, Value>&> item(keyValuePair);
+    Node<Key, Value>* node = allocateNode(item, parent);
+    linkNode(node, parent);
+    return iterator(node);
+}
+
+// The key is only known once the pair exists, so the node is built first and
+// given back if the key turns out to be present already.
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(Args&&... args) {
+    ForwardingItemFactory<Key, Value, Args...> item(std::forward<Args>(args)...);
+    Node<Key, Value>* node = allocateNode(item, nullptr);
+    Node<Key, Value>* parent;
+    Node<Key, Value>* existing = findSlot(node->getKey(), parent);
+    if(existing != nullptr) {
+        destroyNode(node);
+        return std::make_pair(iterator(existing), false);
+    }
+    linkNode(node, parent);
+    return std::make_pair(iterator(node), true);
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args) {
+    return tryEmplaceHelper(key, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args) {
+    return tryEmplaceHelper(std::move(key), std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& value) {
+    std::pair<iterator, bool> result = tryEmplaceHelper(key, std::forward<M>(value));
+    if(!result.second)
+        result.first->second = std::forward<M>(value);
+    return result;
+}
+
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& value) {
+    std::pair<iterator, bool> result = tryEmplaceHelper(std::move(key), std::forward<M>(value));
+    if(!result.second)
+        result.first->second = std::forward<M>(value);
+    return result;
+}
+
+// Nothing is constructed unless the key is missing, so key and args are
+// only consumed when a node is created.
+template<class Key, class Value, class Compare>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::tryEmplaceHelper(K&& key, Args&&... args) {
+    Node<Key, Value>* parent;
+    Node<Key, Value>* existing = findSlot(key, parent);
+    if(existing != nullptr)
+        return std::make_pair(iterator(existing), false);
+    std::tuple<K&&> keyArgs(std::forward<K>(key));
+    std::tuple<Args&&...> valueArgs(std::forward<Args>(args)...);
+    ForwardingItemFactory<Key, Value, const std::piecewise_construct_t&, std::tuple<K&&>, std::tuple<Args&&...> >
+        item(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs));
+    Node<Key, Value>* node = allocateNode(item, parent);
+    linkNode(node, parent);
+    return std::make_pair(iterator(node), true);
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findSlot(const Key& key, Node<Key, Value>*& parent) {
+    parent = nullptr;
     Node<Key, Value>* current = root_;
+    std::size_t depth = 0;
     while(current != nullptr) {
         parent = current;
-        if(keyValuePair.first < current->getKey())
+        ++depth;
+        int order = compare_(key, current->getKey());
+        if(order < 0)
             current = current->getLeft();
-        else if(current->getKey() < keyValuePair.first)
+        else if(order > 0)
             current = current->getRight();
         else {
-            current->setValue(keyValuePair.second);
-            return;
+            recordSearch(depth, depth);
+            return current;
         }
     }
-    if(keyValuePair.first < parent->getKey())
-        parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-    else
-        parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+    recordSearch(depth, depth);
+    return nullptr;
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findSlotNear(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent) {
+    Node<Key, Value>* start = (hint != nullptr) ? hint : getLargestNode();
+    if(start == nullptr) {
+        parent = nullptr;
+        return nullptr;
+    }
+    return fingerSearch(start, key, parent);
+}
+
+// Climbs from start while key may lie outside the current subtree, then
+// descends like findSlot.  order is key's comparison with current, and
+// keeps its sign on the way up: an ancestor on the far side of key is
+// passed without comparing it, and one on key's side is the nearest bound
+// of the subtree there, so the climb stops once key falls short of it.
+// Nothing bounds the largest node from above, so a key beyond it is not
+// climbed for at all.
+template<class Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::fingerSearch(Node<Key, Value>* start, const K& key, Node<Key, Value>*& parent) const {
+    Node<Key, Value>* current = start;
+    std::size_t visited = 1;
+    std::size_t comparisons = 1;
+    int order = compare_(key, current->getKey());
+    if(order == 0) {
+        parent = current->getParent();
+        recordSearch(visited, comparisons);
+        return current;
+    }
+    if(order < 0 || current != rightmost_) {
+        for(Node<Key, Value>* up = current->getParent(); up != nullptr; up = current->getParent()) {
+            ++visited;
+            bool fromLeft = (up->getLeft() == current);
+            if(fromLeft == (order > 0)) {
+                ++comparisons;
+                int bound = compare_(key, up->getKey());
+                if(bound == 0) {
+                    parent = up->getParent();
+                    recordSearch(visited, comparisons);
+                    return up;
+                }
+                if((bound < 0) == fromLeft)
+                    break;
+            }
+            current = up;
+        }
+    }
+    for(;;) {
+        Node<Key, Value>* next = (order < 0) ? current->getLeft() : current->getRight();
+        if(next == nullptr) {
+            parent = current;
+            recordSearch(visited, comparisons);
+            return nullptr;
+        }
+        current = next;
+        ++visited;
+        ++comparisons;
+        order = compare_(key, current->getKey());
+        if(order == 0) {
+            parent = current->getParent();
+            recordSearch(visited, comparisons);
+            return current;
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::allocateNode(ItemFactory<Key, Value>& item, Node<Key, Value>* parent) {
+    return createNode<Node<Key, Value> >(item, parent);
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::linkNode(Node<Key, Value>* node, Node<Key, Value>* parent) {
+    node->setParent(parent);
+    if(parent == nullptr) {
+        root_ = node;
+        rightmost_ = node;
+    }
+    else if(compare_(node->getKey(), parent->getKey()) < 0)
+        parent->setLeft(node);
+    else {
+        parent->setRight(node);
+        if(parent == rightmost_)
+            rightmost_ = node;
+    }
+    ++size_;
+    insertFix(node);
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insertFix(Node<Key, Value>*) {
 }
 
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key) {
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key) {
     Node<Key, Value>* nodeToRemove = internalFind(key);
     if(nodeToRemove == nullptr)
         return;
@@ -409,26 +1413,199 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
         else
             parent->setRight(child);
     }
-    delete nodeToRemove;
+    destroyNode(nodeToRemove);
+    --size_;
 }
 
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::clear() {
-    clearHelper(root_);
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::clear() {
+    // Nodes whose contents need no destructor are dropped with their chunks;
+    // otherwise run the destructors first.  Either way the arena is released
+    // as a whole instead of node by node.
+    if(!(std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value))
+        clearHelper(root_, CLEAR_MAX_DEPTH);
     root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    pool_.release();
 }
 
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* node) {
+// Destroys the contents of node's subtree in post-order, in O(1) space
+// however deep the tree is (an unbalanced tree built from sorted keys is a
+// list).  The recursion is cut off at CLEAR_MAX_DEPTH levels, more than
+// any balanced tree has, and a subtree below that is handed to
+// destroyByRotation.  The slots themselves go back with the pool.
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::clearHelper(Node<Key, Value>* node, int depthLeft) {
     if(node == nullptr)
         return;
-    clearHelper(node->getLeft());
-    clearHelper(node->getRight());
-    delete node;
+    if(depthLeft == 0) {
+        destroyByRotation(node);
+        return;
+    }
+    clearHelper(node->getLeft(), depthLeft - 1);
+    clearHelper(node->getRight(), depthLeft - 1);
+    destruct_(node);
+}
+
+// Each node with a left child is rotated right, straightening the subtree
+// into a chain of right links as it goes; a node with no left child is
+// destroyed and the walk moves right.  O(n) time and O(1) space.
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyByRotation(Node<Key, Value>* node) {
+    while(node != nullptr) {
+        Node<Key, Value>* left = node->getLeft();
+        if(left != nullptr) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else {
+            Node<Key, Value>* right = node->getRight();
+            destruct_(node);
+            node = right;
+        }
+    }
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::cloneFrom(const BinarySearchTree& other) {
+    compare_ = other.compare_;
+    if(other.root_ == nullptr)
+        return;
+    pool_.reserve(other.size_);
+    try {
+        // Pre-order walk of both trees in step, using parent pointers to
+        // climb back up instead of a stack.
+        const Node<Key, Value>* source = other.root_;
+        Node<Key, Value>* copy = cloneNode(source, nullptr);
+        root_ = copy;
+        size_ = 1;
+        while(source != nullptr) {
+            if(source->getLeft() != nullptr && copy->getLeft() == nullptr) {
+                source = source->getLeft();
+                copy->setLeft(cloneNode(source, copy));
+                copy = copy->getLeft();
+                ++size_;
+            }
+            else if(source->getRight() != nullptr && copy->getRight() == nullptr) {
+                source = source->getRight();
+                copy->setRight(cloneNode(source, copy));
+                copy = copy->getRight();
+                ++size_;
+            }
+            else {
+                source = source->getParent();
+                copy = copy->getParent();
+            }
+        }
+    }
+    catch(...) {
+        clear();
+        throw;
+    }
+}
+
+template<typename Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::cloneNode(const Node<Key, Value>* source, Node<Key, Value>* parent) {
+    // Being virtual, this is compiled for move-only values too; copying
+    // such a tree is rejected by the copy constructor instead.
+    if constexpr (std::is_copy_constructible<Value>::value) {
+        ForwardingItemFactory<Key, Value, const std::pair<const Key, Value>&> item(source->getItem());
+        return createNode<Node<Key, Value> >(item, parent);
+    }
+    else {
+        (void)source;
+        (void)parent;
+        throw std::logic_error("cloneNode: Value is not copy constructible");
+    }
 }
 
-template<typename Key, class Value>
-int BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* node) const {
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::swap(BinarySearchTree& other) {
+    std::swap(root_, other.root_);
+    pool_.swap(other.pool_);
+    std::swap(destruct_, other.destruct_);
+    std::swap(size_, other.size_);
+    std::swap(compare_, other.compare_);
+    std::swap(rightmost_, other.rightmost_);
+}
+
+template<typename Key, class Value, class Compare>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare>::buildFromSorted(ForwardIt first, ForwardIt last) {
+    std::size_t n = 0;
+    for(ForwardIt it = first, prev = first; it != last; prev = it, ++it, ++n) {
+        if(n > 0 && compare_(prev->first, it->first) >= 0)
+            throw std::invalid_argument("buildFromSorted: keys are not strictly increasing");
+    }
+    // The new nodes come from an empty pool, so the old contents stay intact
+    // until the build has succeeded and can then be released in one go.
+    NodePool previous(std::move(pool_));
+    pool_.reserve(n);
+    int levels = 0;
+    for(std::size_t count = n; count != 0; count >>= 1)
+        ++levels;
+    Node<Key, Value>* built;
+    try {
+        built = buildSubtree(first, n, levels - 1);
+    }
+    catch(...) {
+        pool_.swap(previous);
+        throw;
+    }
+    pool_.swap(previous);
+    clear();
+    pool_.swap(previous);
+    root_ = built;
+    size_ = n;
+}
+
+// If an item's copy throws, the nodes built so far are destroyed on the way
+// out; their slots go back with the pool.
+template<typename Key, class Value, class Compare>
+template<typename ForwardIt>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::buildSubtree(ForwardIt& it, std::size_t n, int levelsBelow) {
+    if(n == 0)
+        return nullptr;
+    std::size_t leftCount = n / 2;
+    std::size_t rightCount = n - 1 - leftCount;
+    Node<Key, Value>* left = buildSubtree(it, leftCount, levelsBelow - 1);
+    Node<Key, Value>* node;
+    try {
+        ForwardingItemFactory<Key, Value, decltype(*it)> item(*it);
+        node = createBuiltNode(item, leftCount, rightCount, levelsBelow);
+    }
+    catch(...) {
+        clearHelper(left, CLEAR_MAX_DEPTH);
+        throw;
+    }
+    node->setLeft(left);
+    if(left != nullptr)
+        left->setParent(node);
+    ++it;
+    Node<Key, Value>* right;
+    try {
+        right = buildSubtree(it, rightCount, levelsBelow - 1);
+    }
+    catch(...) {
+        clearHelper(node, CLEAR_MAX_DEPTH);
+        throw;
+    }
+    node->setRight(right);
+    if(right != nullptr)
+        right->setParent(node);
+    return node;
+}
+
+template<typename Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::createBuiltNode(ItemFactory<Key, Value>& item,
+                                                               std::size_t, std::size_t, int) {
+    return allocateNode(item, nullptr);
+}
+
+template<typename Key, class Value, class Compare>
+int BinarySearchTree<Key, Value, Compare>::isBalancedHelper(Node<Key, Value>* node) const {
     if(node == nullptr)
         return 0;
     int leftHeight = isBalancedHelper(node->getLeft());
@@ -442,48 +1619,133 @@ int BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* node) const
     return std::max(leftHeight, rightHeight) + 1;
 }
 
-template<typename Key, class Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const {
+template<typename Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const {
     return isBalancedHelper(root_) != -1;
 }
 
+/*
+-----------------------------------------------------
+Statistics
+-----------------------------------------------------
+*/
+template<typename Key, class Value, class Compare>
+TreeStats BinarySearchTree<Key, Value, Compare>::stats() const {
+    TreeStats snapshot = TreeStats();
+#ifdef BST_STATS
+    snapshot.comparisons = stats_.comparisons.get();
+    snapshot.searches = stats_.searches.get();
+    snapshot.totalSearchDepth = stats_.totalSearchDepth.get();
+    snapshot.maxSearchDepth = stats_.maxSearchDepth.get();
+    snapshot.singleRotations = stats_.singleRotations.get();
+    snapshot.doubleRotations = stats_.doubleRotations.get();
+    snapshot.nodeSwaps = stats_.nodeSwaps.get();
+    snapshot.allocations = stats_.allocations.get();
+#endif
+    return snapshot;
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::resetStats() {
+#ifdef BST_STATS
+    stats_.comparisons.set(0);
+    stats_.searches.set(0);
+    stats_.totalSearchDepth.set(0);
+    stats_.maxSearchDepth.set(0);
+    stats_.singleRotations.set(0);
+    stats_.doubleRotations.set(0);
+    stats_.nodeSwaps.set(0);
+    stats_.allocations.set(0);
+#endif
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::recordSearch(std::size_t depth, std::size_t comparisons) const {
+#ifdef BST_STATS
+    stats_.comparisons.add(comparisons);
+    stats_.searches.add(1);
+    stats_.totalSearchDepth.add(depth);
+    if(depth > stats_.maxSearchDepth.get())
+        stats_.maxSearchDepth.set(depth);
+#endif
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::recordRotation(bool isDouble) {
+#ifdef BST_STATS
+    if(isDouble)
+        stats_.doubleRotations.add(1);
+    else
+        stats_.singleRotations.add(1);
+#endif
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::recordNodeSwap() {
+#ifdef BST_STATS
+    stats_.nodeSwaps.add(1);
+#endif
+}
+
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::recordAllocation() {
+#ifdef BST_STATS
+    stats_.allocations.add(1);
+#endif
+}
+
 /*
 -----------------------------------------------------
 Provided Functions: printRoot and nodeSwap
 -----------------------------------------------------
 */
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::print() const {
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const {
     printRoot(root_);
     std::cout << "\n";
 }
 
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::printRoot(Node<Key, Value>* r) const {
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::printRoot(Node<Key, Value>* r) const {
     // Assuming print_bst.h provides this functionality.
 }
 
-template<typename Key, class Value>
-void BinarySearchTree<Key, Value>::nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) {
+template<typename Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) {
     if(n1 == n2 || n1 == nullptr || n2 == nullptr)
         return;
+    recordNodeSwap();
     
     Node<Key, Value>* n1p = n1->getParent();
+    Node<Key, Value>* n1l = n1->getLeft();
+    Node<Key, Value>* n1r = n1->getRight();
     bool n1isLeft = (n1p != nullptr && n1 == n1p->getLeft());
     Node<Key, Value>* n2p = n2->getParent();
+    Node<Key, Value>* n2l = n2->getLeft();
+    Node<Key, Value>* n2r = n2->getRight();
     bool n2isLeft = (n2p != nullptr && n2 == n2p->getLeft());
     
-    Node<Key, Value>* temp = n1->getParent();
-    n1->setParent(n2->getParent());
-    n2->setParent(temp);
-    
-    temp = n1->getLeft();
-    n1->setLeft(n2->getLeft());
-    n2->setLeft(temp);
+    n1->setParent(n2p);
+    n1->setLeft(n2l);
+    n1->setRight(n2r);
+    n2->setParent(n1p);
+    n2->setLeft(n1l);
+    n2->setRight(n1r);
     
-    temp = n1->getRight();
-    n1->setRight(n2->getRight());
-    n2->setRight(temp);
+    // When one node is the other's parent, the copies above leave a node
+    // pointing at itself; point it at the other node instead.
+    if(n1p == n2)
+        n2->setParent(n1);
+    if(n2p == n1)
+        n1->setParent(n2);
+    if(n1->getLeft() == n1)
+        n1->setLeft(n2);
+    if(n1->getRight() == n1)
+        n1->setRight(n2);
+    if(n2->getLeft() == n2)
+        n2->setLeft(n1);
+    if(n2->getRight() == n2)
+        n2->setRight(n1);
     
     if(n1p != nullptr && n1p != n2) {
         if(n1isLeft)
@@ -0,0 +1,553 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include "bst.h"
+
+/**
+ * An AVL tree that many threads can use at once.  Writers (insert, remove)
+ * take a mutex and run the same retracing and rotations as AVLTree, so the
+ * tree is always a valid AVL tree once a writer is done.  Readers (find,
+ * contains) take no lock and never wait for the mutex:
+ *
+ * - Child links are atomic, and a node's key and value never change once it
+ *   is linked in.  Updating a value links in a fresh copy of the node.
+ * - Rotations and removals can move a key out of the part of the tree a
+ *   reader is searching.  Writers bump a version counter (a seqlock) around
+ *   them, and a reader that sees the version change during its descent
+ *   simply searches again.  Adding a leaf or replacing a node cannot hide
+ *   any key, so those do not bump the version.
+ * - Unlinked nodes are not freed right away, since a reader may still be
+ *   standing on one.  Readers announce themselves in per-thread-striped
+ *   counters, one set per epoch.  Every RETIRE_BATCH retirements a writer
+ *   starts a new epoch and waits only for readers that entered in the old
+ *   one, then frees the batch.
+ *
+ * Keys are ordered by the three-way comparator Compare, as in
+ * BinarySearchTree; readers call it concurrently, so it must be safe to
+ * call from several threads.  clear() and destruction must not run
+ * concurrently with any other call.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
+class ConcurrentAVLTree {
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    // Copies the value stored under key into value and returns true, or
+    // returns false if key is not present.
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+    void clear();
+
+private:
+    // Trees own their nodes' pool, so they cannot be copied.
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    struct Node {
+        Node(const Key& key, const Value& value, Node* parent)
+            : item(key, value), left(nullptr), right(nullptr), parent(parent), balance(0) {}
+
+        const std::pair<const Key, Value> item;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        Node* parent;       // only used by writers
+        int8_t balance;     // left height - right height; only used by writers
+    };
+
+    // Read-side announcement counters, one per epoch parity.  Each stripe
+    // gets its own cache line so readers on different threads do not
+    // contend on a shared counter.
+    struct alignas(64) ReaderStripe {
+        std::atomic<long> active[2];
+    };
+    static const std::size_t READER_STRIPES = 16;
+    static const std::size_t RETIRE_BATCH = 64;
+
+    // Read side.
+    template<typename Visit>
+    bool readNode(const Key& key, Visit visit) const;
+    std::atomic<long>& enterRead() const;
+    static std::size_t stripeIndex();
+
+    // Write side; all called with writeLock_ held.
+    Node* createNode(const Key& key, const Value& value, Node* parent);
+    void retire(Node* node);
+    void reclaim(bool force);
+    void beginRestructure();
+    void endRestructure();
+    void replaceChild(Node* parent, Node* oldChild, Node* newChild);
+    void replaceNode(Node* node, Node* fresh);
+    void insertFix(Node* node);
+    void removeFix(Node* parent, bool leftShorter);
+    Node* rotateLeft(Node* root);
+    Node* rotateRight(Node* root);
+    Node* rebalance(Node* node);
+    void destroySubtree(Node* node);
+    int isBalancedHelper(Node* node) const;
+
+    static Node* leftOf(Node* node) { return node->left.load(std::memory_order_relaxed); }
+    static Node* rightOf(Node* node) { return node->right.load(std::memory_order_relaxed); }
+
+    std::atomic<Node*> root_;
+    std::atomic<uint64_t> version_;     // odd while a restructure is under way
+    std::atomic<unsigned> epoch_;
+    std::atomic<std::size_t> size_;
+    mutable ReaderStripe readers_[READER_STRIPES];
+    mutable std::mutex writeLock_;
+    NodePool pool_;
+    std::vector<Node*> retired_;
+    Compare compare_;
+};
+
+/*
+----------------------------------------------------
+Begin implementations for the ConcurrentAVLTree class.
+----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree()
+    : root_(nullptr), version_(0), epoch_(0), size_(0),
+      pool_(sizeof(Node), alignof(Node))
+{
+    for(std::size_t i = 0; i < READER_STRIPES; ++i) {
+        readers_[i].active[0].store(0, std::memory_order_relaxed);
+        readers_[i].active[1].store(0, std::memory_order_relaxed);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree() {
+    clear();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const {
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const {
+    return size() == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear() {
+    std::lock_guard<std::mutex> lock(writeLock_);
+    reclaim(true);
+    if(!(std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value))
+        destroySubtree(root_.load(std::memory_order_relaxed));
+    root_.store(nullptr, std::memory_order_relaxed);
+    size_.store(0, std::memory_order_relaxed);
+    pool_.release();
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroySubtree(Node* node) {
+    if(node == nullptr)
+        return;
+    destroySubtree(leftOf(node));
+    destroySubtree(rightOf(node));
+    node->~Node();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const {
+    std::lock_guard<std::mutex> lock(writeLock_);
+    return isBalancedHelper(root_.load(std::memory_order_relaxed)) != -1;
+}
+
+// Returns the height of node's subtree, or -1 if it is not a valid AVL
+// subtree or its balance factors are stale.
+template<typename Key, typename Value, typename Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::isBalancedHelper(Node* node) const {
+    if(node == nullptr)
+        return 0;
+    int leftHeight = isBalancedHelper(leftOf(node));
+    if(leftHeight == -1)
+        return -1;
+    int rightHeight = isBalancedHelper(rightOf(node));
+    if(rightHeight == -1)
+        return -1;
+    if(leftHeight - rightHeight != node->balance || std::abs(leftHeight - rightHeight) > 1)
+        return -1;
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/*
+-----------------------------------------------------
+Read side
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const {
+    return readNode(key, [&value](const Node* node) { value = node->item.second; });
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const {
+    return readNode(key, [](const Node*) {});
+}
+
+// Searches for key without locking and calls visit on its node.  The search
+// is retried if a restructure overlapped it; visit may then run more than
+// once, but the last call is for a node that was current.
+template<typename Key, typename Value, typename Compare>
+template<typename Visit>
+bool ConcurrentAVLTree<Key, Value, Compare>::readNode(const Key& key, Visit visit) const {
+    std::atomic<long>& slot = enterRead();
+    bool found;
+    for(;;) {
+        uint64_t before = version_.load(std::memory_order_acquire);
+        if(before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        const Node* current = root_.load(std::memory_order_acquire);
+        while(current != nullptr) {
+            int order = compare_(key, current->item.first);
+            if(order < 0)
+                current = current->left.load(std::memory_order_acquire);
+            else if(order > 0)
+                current = current->right.load(std::memory_order_acquire);
+            else
+                break;
+        }
+        found = (current != nullptr);
+        if(found)
+            visit(current);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(version_.load(std::memory_order_relaxed) == before)
+            break;
+    }
+    slot.fetch_sub(1, std::memory_order_release);
+    return found;
+}
+
+// Registers a reader in the current epoch.  The epoch is checked again after
+// the increment so that a writer that has moved on to a newer epoch never
+// misses a reader that could still see nodes it is about to free.
+template<typename Key, typename Value, typename Compare>
+std::atomic<long>& ConcurrentAVLTree<Key, Value, Compare>::enterRead() const {
+    ReaderStripe& stripe = readers_[stripeIndex()];
+    for(;;) {
+        unsigned epoch = epoch_.load(std::memory_order_seq_cst);
+        std::atomic<long>& slot = stripe.active[epoch & 1];
+        slot.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(epoch_.load(std::memory_order_seq_cst) == epoch)
+            return slot;
+        slot.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::stripeIndex() {
+    static thread_local std::size_t index =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % READER_STRIPES;
+    return index;
+}
+
+/*
+-----------------------------------------------------
+Write side: allocation and reclamation
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::createNode(const Key& key, const Value& value, Node* parent) {
+    void* slot = pool_.allocate();
+    try {
+        return new (slot) Node(key, value, parent);
+    }
+    catch(...) {
+        pool_.deallocate(slot);
+        throw;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retire(Node* node) {
+    retired_.push_back(node);
+}
+
+// Frees the retired nodes once no reader can reach them: every reader that
+// entered before the epoch flip has left.  Readers entering afterwards
+// start from the current links, which no longer lead to retired nodes.
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaim(bool force) {
+    if(retired_.empty() || (!force && retired_.size() < RETIRE_BATCH))
+        return;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    unsigned old = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    for(std::size_t i = 0; i < READER_STRIPES; ++i) {
+        while(readers_[i].active[old & 1].load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+    }
+    for(std::size_t i = 0; i < retired_.size(); ++i) {
+        retired_[i]->~Node();
+        pool_.deallocate(retired_[i]);
+    }
+    retired_.clear();
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::beginRestructure() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::endRestructure() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/*
+-----------------------------------------------------
+Write side: insert and remove
+-----------------------------------------------------
+*/
+// Points whichever link of parent (or the root) held oldChild at newChild.
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::replaceChild(Node* parent, Node* oldChild, Node* newChild) {
+    if(newChild != nullptr)
+        newChild->parent = parent;
+    if(parent == nullptr)
+        root_.store(newChild, std::memory_order_release);
+    else if(leftOf(parent) == oldChild)
+        parent->left.store(newChild, std::memory_order_release);
+    else
+        parent->right.store(newChild, std::memory_order_release);
+}
+
+// Puts fresh in node's place, with node's children and balance, and retires
+// node.  Readers see either node or fresh, and both lead to the same keys.
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::replaceNode(Node* node, Node* fresh) {
+    Node* left = leftOf(node);
+    Node* right = rightOf(node);
+    fresh->left.store(left, std::memory_order_relaxed);
+    fresh->right.store(right, std::memory_order_relaxed);
+    fresh->balance = node->balance;
+    if(left != nullptr)
+        left->parent = fresh;
+    if(right != nullptr)
+        right->parent = fresh;
+    replaceChild(node->parent, node, fresh);
+    retire(node);
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair) {
+    const Key& key = keyValuePair.first;
+    std::lock_guard<std::mutex> lock(writeLock_);
+    Node* parent = nullptr;
+    Node* current = root_.load(std::memory_order_relaxed);
+    while(current != nullptr) {
+        parent = current;
+        int order = compare_(key, current->item.first);
+        if(order < 0)
+            current = leftOf(current);
+        else if(order > 0)
+            current = rightOf(current);
+        else {
+            // Key already exists: publish a copy holding the new value.
+            replaceNode(current, createNode(key, keyValuePair.second, nullptr));
+            reclaim(false);
+            return;
+        }
+    }
+
+    // The new leaf is fully built before the release store makes it visible.
+    Node* node = createNode(key, keyValuePair.second, parent);
+    if(parent == nullptr)
+        root_.store(node, std::memory_order_release);
+    else if(compare_(key, parent->item.first) < 0)
+        parent->left.store(node, std::memory_order_release);
+    else
+        parent->right.store(node, std::memory_order_release);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    insertFix(node);
+}
+
+// Same retracing as AVLTree::insertFix; only the rotation is a restructure.
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insertFix(Node* node) {
+    Node* child = node;
+    Node* parent = child->parent;
+    while(parent != nullptr) {
+        parent->balance += (child == leftOf(parent)) ? 1 : -1;
+        if(parent->balance == 0)
+            return;
+        if(parent->balance == 2 || parent->balance == -2) {
+            beginRestructure();
+            rebalance(parent);
+            endRestructure();
+            return;
+        }
+        child = parent;
+        parent = parent->parent;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key) {
+    std::lock_guard<std::mutex> lock(writeLock_);
+    Node* node = root_.load(std::memory_order_relaxed);
+    while(node != nullptr) {
+        int order = compare_(key, node->item.first);
+        if(order < 0)
+            node = leftOf(node);
+        else if(order > 0)
+            node = rightOf(node);
+        else
+            break;
+    }
+    if(node == nullptr)
+        return;
+
+    // Node with two children: AVLTree swaps it with its predecessor.  Here a
+    // copy of the predecessor takes node's place instead, so that no linked
+    // node changes key, and the predecessor itself is removed below.  The
+    // copy is made first so that a throwing copy leaves the tree untouched.
+    Node* pred = nullptr;
+    Node* copy = nullptr;
+    if(leftOf(node) != nullptr && rightOf(node) != nullptr) {
+        pred = leftOf(node);
+        while(rightOf(pred) != nullptr)
+            pred = rightOf(pred);
+        copy = createNode(pred->item.first, pred->item.second, nullptr);
+    }
+
+    beginRestructure();
+    if(copy != nullptr) {
+        replaceNode(node, copy);
+        node = pred;
+    }
+
+    Node* child = (leftOf(node) != nullptr) ? leftOf(node) : rightOf(node);
+    Node* parent = node->parent;
+    bool wasLeft = (parent != nullptr && leftOf(parent) == node);
+    replaceChild(parent, node, child);
+    retire(node);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    removeFix(parent, wasLeft);
+    endRestructure();
+    reclaim(false);
+}
+
+// Same retracing as AVLTree::removeFix.
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::removeFix(Node* parent, bool leftShorter) {
+    while(parent != nullptr) {
+        parent->balance += leftShorter ? -1 : 1;
+        if(parent->balance == 1 || parent->balance == -1)
+            return;
+        Node* subtree = parent;
+        if(parent->balance == 2 || parent->balance == -2) {
+            subtree = rebalance(parent);
+            // A rotation that leaves the new root tilted kept the old height.
+            if(subtree->balance != 0)
+                return;
+        }
+        parent = subtree->parent;
+        if(parent != nullptr)
+            leftShorter = (leftOf(parent) == subtree);
+    }
+}
+
+/*
+-----------------------------------------------------
+Rotations
+-----------------------------------------------------
+*/
+// The links are rewritten top-down so that a reader racing with a rotation
+// never follows a cycle; it may miss keys, which the version check catches.
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight(Node* root) {
+    Node* leftChild = leftOf(root);
+    Node* inner = rightOf(leftChild);
+    root->left.store(inner, std::memory_order_release);
+    if(inner != nullptr)
+        inner->parent = root;
+    leftChild->right.store(root, std::memory_order_release);
+    leftChild->parent = root->parent;
+    root->parent = leftChild;
+
+    int8_t rootBal = root->balance - 1 - std::max<int8_t>(leftChild->balance, 0);
+    int8_t childBal = leftChild->balance - 1 + std::min<int8_t>(rootBal, 0);
+    root->balance = rootBal;
+    leftChild->balance = childBal;
+    return leftChild;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft(Node* root) {
+    Node* rightChild = rightOf(root);
+    Node* inner = leftOf(rightChild);
+    root->right.store(inner, std::memory_order_release);
+    if(inner != nullptr)
+        inner->parent = root;
+    rightChild->left.store(root, std::memory_order_release);
+    rightChild->parent = root->parent;
+    root->parent = rightChild;
+
+    int8_t rootBal = root->balance + 1 - std::min<int8_t>(rightChild->balance, 0);
+    int8_t childBal = rightChild->balance + 1 + std::max<int8_t>(rootBal, 0);
+    root->balance = rootBal;
+    rightChild->balance = childBal;
+    return rightChild;
+}
+
+// Rotates the out-of-balance subtree at node (a double rotation when the
+// taller child leans inward) and links the new subtree root in its place.
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance(Node* node) {
+    Node* parent = node->parent;
+    Node* subtree;
+    if(node->balance > 0) {
+        if(leftOf(node)->balance < 0) {
+            Node* left = rotateLeft(leftOf(node));
+            node->left.store(left, std::memory_order_release);
+            left->parent = node;
+        }
+        subtree = rotateRight(node);
+    }
+    else {
+        if(rightOf(node)->balance > 0) {
+            Node* right = rotateRight(rightOf(node));
+            node->right.store(right, std::memory_order_release);
+            right->parent = node;
+        }
+        subtree = rotateLeft(node);
+    }
+    replaceChild(parent, node, subtree);
+    return subtree;
+}
+
+/*
+--------------------------------------------------
+End implementations for the ConcurrentAVLTree class.
+--------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef FROZENBST_H
+#define FROZENBST_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "keycompare.h"
+
+/**
+ * A read-only search index over a sorted set of key/value pairs, as produced
+ * by BinarySearchTree::freeze().
+ *
+ * The entries are stored in Eytzinger (BFS) order: the implicit tree's root
+ * is at position 1 and the children of position i are at 2i and 2i+1.  The
+ * top levels of the tree therefore share a few cache lines, and a search
+ * touches one array instead of chasing pointers between separately allocated
+ * nodes.  Keys live in their own array so that each cache line fetched during
+ * a search is all keys; the pairs are only read once the search is done.
+ *
+ * The search loop has no data-dependent branch (the comparison result is
+ * folded into the next index), and it prefetches the cache line holding the
+ * node's descendants a few levels down.  Keys are ordered by Compare (see
+ * keycompare.h); a transparent Compare enables the lookups taking other key
+ * types.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
+class FrozenIndex {
+public:
+    /**
+    * Iterates over the entries in key order by walking the implicit tree.
+    */
+    class iterator {
+    public:
+        iterator();
+
+        const std::pair<Key, Value>& operator*() const;
+        const std::pair<Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    private:
+        friend class FrozenIndex<Key, Value, Compare>;
+        iterator(const FrozenIndex<Key, Value, Compare>* index, std::size_t position);
+
+        const FrozenIndex<Key, Value, Compare>* index_;
+        std::size_t position_;      // 1-based Eytzinger position; 0 is end()
+    };
+
+    FrozenIndex();
+    // Builds the index from the pairs in [first, last), which must be in
+    // strictly increasing key order.
+    template<typename ForwardIt>
+    FrozenIndex(ForwardIt first, ForwardIt last);
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+private:
+    template<typename ForwardIt>
+    void layout(const std::vector<ForwardIt>& sorted, std::size_t position, std::size_t& next,
+                std::vector<std::size_t>& order);
+    template<typename K>
+    std::size_t findPosition(const K& key) const;
+    template<typename K>
+    std::size_t lowerBoundPosition(const K& key) const;
+
+    // Both arrays are indexed by Eytzinger position - 1.
+    std::vector<Key> keys_;
+    std::vector<std::pair<Key, Value> > items_;
+    Compare compare_;
+};
+
+/*
+------------------------------------------------------
+Begin implementations for the FrozenIndex::iterator class.
+------------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenIndex<Key, Value, Compare>::iterator::iterator()
+    : index_(nullptr), position_(0)
+{}
+
+template<typename Key, typename Value, typename Compare>
+FrozenIndex<Key, Value, Compare>::iterator::iterator(const FrozenIndex<Key, Value, Compare>* index, std::size_t position)
+    : index_(index), position_(position)
+{}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<Key, Value>& FrozenIndex<Key, Value, Compare>::iterator::operator*() const {
+    return index_->items_[position_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<Key, Value>* FrozenIndex<Key, Value, Compare>::iterator::operator->() const {
+    return &(index_->items_[position_ - 1]);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenIndex<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const {
+    return position_ == rhs.position_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenIndex<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const {
+    return position_ != rhs.position_;
+}
+
+// In-order successor in the implicit tree: the leftmost position of the right
+// subtree if there is one, otherwise the first ancestor reached from a left
+// child.
+template<typename Key, typename Value, typename Compare>
+typename FrozenIndex<Key, Value, Compare>::iterator&
+FrozenIndex<Key, Value, Compare>::iterator::operator++() {
+    std::size_t n = index_->items_.size();
+    if(2 * position_ + 1 <= n) {
+        position_ = 2 * position_ + 1;
+        while(2 * position_ <= n)
+            position_ *= 2;
+    }
+    else {
+        while(position_ & 1)
+            position_ >>= 1;
+        position_ >>= 1;
+    }
+    return *this;
+}
+
+/*
+----------------------------------------------------
+End implementations for the FrozenIndex::iterator class.
+----------------------------------------------------
+*/
+
+/*
+---------------------------------------------
+Begin implementations for the FrozenIndex class.
+---------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenIndex<Key, Value, Compare>::FrozenIndex()
+{}
+
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+FrozenIndex<Key, Value, Compare>::FrozenIndex(ForwardIt first, ForwardIt last) {
+    std::vector<ForwardIt> sorted;
+    for(; first != last; ++first)
+        sorted.push_back(first);
+
+    // order[p - 1] is the rank of the entry that belongs at position p.
+    std::vector<std::size_t> order(sorted.size());
+    std::size_t next = 0;
+    layout(sorted, 1, next, order);
+
+    keys_.reserve(sorted.size());
+    items_.reserve(sorted.size());
+    for(std::size_t i = 0; i < order.size(); ++i) {
+        const ForwardIt& it = sorted[order[i]];
+        keys_.push_back(it->first);
+        items_.push_back(std::pair<Key, Value>(it->first, it->second));
+    }
+}
+
+// Visits the implicit tree in order, handing out ranks as it goes.
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+void FrozenIndex<Key, Value, Compare>::layout(const std::vector<ForwardIt>& sorted, std::size_t position,
+                                     std::size_t& next, std::vector<std::size_t>& order) {
+    if(position > sorted.size())
+        return;
+    layout(sorted, 2 * position, next, order);
+    order[position - 1] = next++;
+    layout(sorted, 2 * position + 1, next, order);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::begin() const {
+    std::size_t position = items_.empty() ? 0 : 1;
+    while(position != 0 && 2 * position <= items_.size())
+        position *= 2;
+    return iterator(this, position);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::end() const {
+    return iterator(this, 0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::find(const Key& key) const {
+    return iterator(this, findPosition(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::lower_bound(const Key& key) const {
+    return iterator(this, lowerBoundPosition(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::find(const K& key) const {
+    return iterator(this, findPosition(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenIndex<Key, Value, Compare>::iterator FrozenIndex<Key, Value, Compare>::lower_bound(const K& key) const {
+    return iterator(this, lowerBoundPosition(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenIndex<Key, Value, Compare>::size() const {
+    return items_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenIndex<Key, Value, Compare>::empty() const {
+    return items_.empty();
+}
+
+// Descends to a leaf, going right whenever the key at the current position is
+// smaller than key.  The path taken is encoded in the bits of position: the
+// lower bound is the last node where the search went left, found by dropping
+// the trailing right turns (1 bits) and the left turn before them.
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+std::size_t FrozenIndex<Key, Value, Compare>::findPosition(const K& key) const {
+    std::size_t position = lowerBoundPosition(key);
+    if(position != 0 && compare_(key, keys_[position - 1]) < 0)
+        position = 0;
+    return position;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+std::size_t FrozenIndex<Key, Value, Compare>::lowerBoundPosition(const K& key) const {
+    const std::size_t n = keys_.size();
+    const std::size_t perLine = (sizeof(Key) < 64) ? 64 / sizeof(Key) : 1;
+    const Key* keys = keys_.data();
+    std::size_t position = 1;
+    while(position <= n) {
+#if defined(__GNUC__)
+        // The descendants log2(perLine) levels down share one cache line.
+        std::size_t ahead = position * perLine;
+        __builtin_prefetch(keys + (ahead < n ? ahead : n) - 1);
+#endif
+        position = 2 * position + (compare_(keys[position - 1], key) < 0);
+    }
+    while(position & 1)
+        position >>= 1;
+    return position >> 1;
+}
+
+/*
+-------------------------------------------
+End implementations for the FrozenIndex class.
+-------------------------------------------
+*/
+
+#endif
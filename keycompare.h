@@ -0,0 +1,50 @@
+#ifndef KEYCOMPARE_H
+#define KEYCOMPARE_H
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * Three-way key comparison for the search trees and indexes.  A comparator
+ * is called as compare(a, b) and returns a negative number, zero, or a
+ * positive number as a orders before, together with, or after b, so each
+ * node a search visits costs one call.
+ *
+ * A comparator that defines is_transparent also accepts other types that
+ * compare against Key, and the trees then offer heterogeneous lookups: for
+ * example find(std::string_view) on a tree of std::string keys, with no
+ * temporary string built.
+ *
+ * DefaultCompare needs only operator< on Key, calling it a second time
+ * when the first call says "not less".  It is specialized for arithmetic
+ * keys, where both tests compile to one machine comparison, and for
+ * strings, where one compare() call does the work of both tests and any
+ * string-like argument is accepted.
+ */
+template <typename Key, typename Enable = void>
+struct DefaultCompare {
+    int operator()(const Key& a, const Key& b) const {
+        if(a < b)
+            return -1;
+        return (b < a) ? 1 : 0;
+    }
+};
+
+template <typename Key>
+struct DefaultCompare<Key, typename std::enable_if<std::is_arithmetic<Key>::value>::type> {
+    int operator()(Key a, Key b) const {
+        return (a < b) ? -1 : static_cast<int>(b < a);
+    }
+};
+
+template <typename CharT, typename Traits, typename Alloc>
+struct DefaultCompare<std::basic_string<CharT, Traits, Alloc>, void> {
+    typedef void is_transparent;
+
+    int operator()(std::basic_string_view<CharT, Traits> a, std::basic_string_view<CharT, Traits> b) const {
+        return a.compare(b);
+    }
+};
+
+#endif
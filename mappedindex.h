@@ -0,0 +1,167 @@
+#ifndef MAPPEDINDEX_H
+#define MAPPEDINDEX_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "keycompare.h"
+#include "snapshotbst.h"
+
+/**
+ * A read-only index served straight from a fixed-layout snapshot file.  The
+ * file is mapped into memory and find() binary searches its key array in
+ * place, so opening costs no decoding or copying, and pages are only read
+ * from disk as searches touch them.  Verifying the checksum reads the whole
+ * file once; pass verify = false to skip it when opening must stay O(1).
+ * Compare must be the order of the tree that saved the file.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
+class MappedIndex {
+    static_assert(UsesFixedSnapshot<Key, Value>::value,
+                  "MappedIndex needs trivially copyable keys and values");
+
+public:
+    explicit MappedIndex(const std::string& path, bool verify = true);
+    MappedIndex(MappedIndex&& other);
+    MappedIndex& operator=(MappedIndex other);
+    ~MappedIndex();
+
+    // Returns the value stored with key, or nullptr if there is none.
+    const Value* find(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+private:
+    MappedIndex(const MappedIndex&);
+
+    void* map_;
+    std::size_t mapLength_;
+    const Key* keys_;
+    const Value* values_;
+    std::size_t count_;
+    Compare compare_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the MappedIndex class.
+  ---------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+MappedIndex<Key, Value, Compare>::MappedIndex(const std::string& path, bool verify) :
+    map_(nullptr),
+    mapLength_(0),
+    keys_(nullptr),
+    values_(nullptr),
+    count_(0)
+{
+    typedef FixedSnapshotLayout<Key, Value> Layout;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("snapshot: cannot open " + path);
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("snapshot: cannot read " + path);
+    }
+    mapLength_ = static_cast<std::size_t>(info.st_size);
+    map_ = ::mmap(nullptr, mapLength_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw std::runtime_error("snapshot: cannot map " + path);
+    }
+
+    const char* base = static_cast<const char*>(map_);
+    try {
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        checkSnapshotHeader<Key, Value>(header, mapLength_);
+        if(verify) {
+            SnapshotChecksum checksum;
+            checksum.update(base + sizeof(header), mapLength_ - sizeof(header));
+            if(checksum.value() != header.checksum)
+                throw std::runtime_error("snapshot: checksum mismatch in " + path);
+        }
+        count_ = header.count;
+    }
+    catch(...) {
+        ::munmap(map_, mapLength_);
+        throw;
+    }
+    keys_ = reinterpret_cast<const Key*>(base + Layout::keysOffset());
+    values_ = reinterpret_cast<const Value*>(base + Layout::valuesOffset(count_));
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedIndex<Key, Value, Compare>::MappedIndex(MappedIndex&& other) :
+    map_(other.map_),
+    mapLength_(other.mapLength_),
+    keys_(other.keys_),
+    values_(other.values_),
+    count_(other.count_),
+    compare_(other.compare_)
+{
+    other.map_ = nullptr;
+    other.mapLength_ = 0;
+    other.count_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedIndex<Key, Value, Compare>& MappedIndex<Key, Value, Compare>::operator=(MappedIndex other) {
+    std::swap(map_, other.map_);
+    std::swap(mapLength_, other.mapLength_);
+    std::swap(keys_, other.keys_);
+    std::swap(values_, other.values_);
+    std::swap(count_, other.count_);
+    std::swap(compare_, other.compare_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedIndex<Key, Value, Compare>::~MappedIndex() {
+    if(map_ != nullptr)
+        ::munmap(map_, mapLength_);
+}
+
+// Branch-free binary search: each step halves the range with a conditional
+// move, so the loop runs log2(n) times whatever the keys.
+template<typename Key, typename Value, typename Compare>
+const Value* MappedIndex<Key, Value, Compare>::find(const Key& key) const {
+    if(count_ == 0)
+        return nullptr;
+    const Key* base = keys_;
+    std::size_t n = count_;
+    while(n > 1) {
+        std::size_t half = n / 2;
+        base = (compare_(key, base[half]) < 0) ? base : base + half;
+        n -= half;
+    }
+    if(compare_(key, *base) != 0)
+        return nullptr;
+    return values_ + (base - keys_);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t MappedIndex<Key, Value, Compare>::size() const {
+    return count_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedIndex<Key, Value, Compare>::empty() const {
+    return count_ == 0;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the MappedIndex class.
+  -------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,491 @@
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include "keycompare.h"
+
+/**
+ * An AVL tree whose versions can be kept: snapshot() returns, in O(1), a
+ * tree that keeps the current contents however this one changes later.
+ *
+ * Nodes have no parent pointer, so one node can sit in the trees of many
+ * versions at once; each node counts the versions and parent nodes that
+ * share it.  insert() and remove() copy the O(log n) nodes on the path to
+ * the change and share everything else.  A node that only this tree
+ * reaches is updated in place rather than copied, so a tree with no live
+ * snapshots copies nothing.
+ *
+ * Versions are independent values.  Different versions may be read and
+ * written from different threads at the same time (the counts are atomic),
+ * but a single version is not synchronized, just like the other trees.
+ * Writing to a tree invalidates its own iterators, never a snapshot's.
+ * Keys are ordered by the three-way comparator Compare, as in
+ * BinarySearchTree, and snapshots share their tree's comparator.
+ */
+template <typename Key, typename Value, typename Compare = DefaultCompare<Key> >
+class PersistentAVLTree {
+    struct Node;
+
+public:
+    /**
+    * An in-order iterator.  With no parent pointers to climb, it keeps the
+    * ancestors still to be visited on a stack.  Items are shared between
+    * versions, so they are read-only.
+    */
+    class iterator {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    private:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        void pushLeftSpine(const Node* node);
+
+        // The top is the current node; below it are the ancestors whose
+        // left subtree is being visited.
+        std::vector<const Node*> path_;
+    };
+
+    PersistentAVLTree();
+    PersistentAVLTree(const PersistentAVLTree& other);      // O(1): shares all nodes
+    PersistentAVLTree(PersistentAVLTree&& other);
+    PersistentAVLTree& operator=(PersistentAVLTree other);
+    ~PersistentAVLTree();
+
+    // An O(1) read-only copy of the current version.
+    PersistentAVLTree snapshot() const;
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    std::size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+
+private:
+    struct Node {
+        Node(const std::pair<const Key, Value>& item, Node* left, Node* right, uint8_t height)
+            : item(item), left(left), right(right), height(height), refs(1) {}
+
+        std::pair<const Key, Value> item;
+        Node* left;
+        Node* right;
+        uint8_t height;
+        std::atomic<uint32_t> refs;     // versions and parents sharing this node
+    };
+
+    // Reference counting.  Helpers that take a Node* consume one reference
+    // to it, and helpers that return a Node* hand one back.
+    static Node* retain(Node* node);
+    static void release(Node* node);
+    static Node* unshare(Node* node);
+
+    Node* insertHelper(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added) const;
+    Node* removeHelper(Node* node, const Key& key) const;
+    static Node* removeMin(Node* node, Node*& min);
+
+    // Rebalancing on uniquely owned nodes.
+    static int height(const Node* node);
+    static void updateHeight(Node* node);
+    static Node* rotateLeft(Node* root);
+    static Node* rotateRight(Node* root);
+    static Node* rebalance(Node* node);
+
+    static int isBalancedHelper(const Node* node);
+
+    Node* root_;
+    std::size_t size_;
+    Compare compare_;
+};
+
+/*
+----------------------------------------------------------
+Begin implementations for the PersistentAVLTree::iterator class.
+----------------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::iterator::iterator()
+{}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key, Value>& PersistentAVLTree<Key, Value, Compare>::iterator::operator*() const {
+    return path_.back()->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value, Compare>::iterator::operator->() const {
+    return &(path_.back()->item);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const {
+    if(path_.empty() || rhs.path_.empty())
+        return path_.empty() == rhs.path_.empty();
+    return path_.back() == rhs.path_.back();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const {
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator&
+PersistentAVLTree<Key, Value, Compare>::iterator::operator++() {
+    const Node* current = path_.back();
+    path_.pop_back();
+    pushLeftSpine(current->right);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::iterator::pushLeftSpine(const Node* node) {
+    for(; node != nullptr; node = node->left)
+        path_.push_back(node);
+}
+
+/*
+--------------------------------------------------------
+End implementations for the PersistentAVLTree::iterator class.
+--------------------------------------------------------
+*/
+
+/*
+-------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+-------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree()
+    : root_(nullptr), size_(0)
+{}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other)
+    : root_(retain(other.root_)), size_(other.size_), compare_(other.compare_)
+{}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(PersistentAVLTree&& other)
+    : root_(other.root_), size_(other.size_), compare_(other.compare_)
+{
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>& PersistentAVLTree<Key, Value, Compare>::operator=(PersistentAVLTree other) {
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    std::swap(compare_, other.compare_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree() {
+    release(root_);
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare> PersistentAVLTree<Key, Value, Compare>::snapshot() const {
+    return PersistentAVLTree(*this);
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear() {
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const {
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const {
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const {
+    return isBalancedHelper(root_) != -1;
+}
+
+// Returns the height of node's subtree, or -1 if it is unbalanced or a
+// stored height is stale.
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::isBalancedHelper(const Node* node) {
+    if(node == nullptr)
+        return 0;
+    int leftHeight = isBalancedHelper(node->left);
+    if(leftHeight == -1)
+        return -1;
+    int rightHeight = isBalancedHelper(node->right);
+    if(rightHeight == -1)
+        return -1;
+    int nodeHeight = std::max(leftHeight, rightHeight) + 1;
+    if(std::abs(leftHeight - rightHeight) > 1 || nodeHeight != node->height)
+        return -1;
+    return nodeHeight;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator PersistentAVLTree<Key, Value, Compare>::begin() const {
+    iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator PersistentAVLTree<Key, Value, Compare>::end() const {
+    return iterator();
+}
+
+// Records the ancestors that iteration will come back to on the way down.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const {
+    iterator it;
+    const Node* current = root_;
+    while(current != nullptr) {
+        int order = compare_(key, current->item.first);
+        if(order < 0) {
+            it.path_.push_back(current);
+            current = current->left;
+        }
+        else if(order > 0)
+            current = current->right;
+        else {
+            it.path_.push_back(current);
+            return it;
+        }
+    }
+    return end();
+}
+
+/*
+-----------------------------------------------------
+Reference counting
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node* PersistentAVLTree<Key, Value, Compare>::retain(Node* node) {
+    if(node != nullptr)
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+// Drops one reference; nodes nobody shares any more are freed along with
+// the references they held, using an explicit stack.
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(Node* node) {
+    std::vector<Node*> pending;
+    while(true) {
+        if(node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pending.push_back(node->left);
+            pending.push_back(node->right);
+            delete node;
+        }
+        if(pending.empty())
+            return;
+        node = pending.back();
+        pending.pop_back();
+    }
+}
+
+// Returns a node that only the caller holds, with node's contents: node
+// itself if the caller was its only holder, else a copy sharing node's
+// children.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node* PersistentAVLTree<Key, Value, Compare>::unshare(Node* node) {
+    if(node->refs.load(std::memory_order_acquire) == 1)
+        return node;
+    Node* copy = new Node(node->item, retain(node->left), retain(node->right), node->height);
+    release(node);
+    return copy;
+}
+
+/*
+-----------------------------------------------------
+Insertion and removal
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair) {
+    bool added = false;
+    root_ = insertHelper(root_, keyValuePair, added);
+    if(added)
+        ++size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::insertHelper(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added) const {
+    if(node == nullptr) {
+        added = true;
+        return new Node(keyValuePair, nullptr, nullptr, 1);
+    }
+    int order = compare_(keyValuePair.first, node->item.first);
+    if(order < 0) {
+        node = unshare(node);
+        node->left = insertHelper(node->left, keyValuePair, added);
+        return rebalance(node);
+    }
+    if(order > 0) {
+        node = unshare(node);
+        node->right = insertHelper(node->right, keyValuePair, added);
+        return rebalance(node);
+    }
+
+    // Key already exists: update value, in a copy if the node is shared.
+    if(node->refs.load(std::memory_order_acquire) == 1) {
+        node->item.second = keyValuePair.second;
+        return node;
+    }
+    Node* copy = new Node(keyValuePair, retain(node->left), retain(node->right), node->height);
+    release(node);
+    return copy;
+}
+
+// Checks for the key first, so that removing a missing key copies nothing.
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key) {
+    if(find(key) == end())
+        return;
+    root_ = removeHelper(root_, key);
+    --size_;
+}
+
+// key must be in node's subtree.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeHelper(Node* node, const Key& key) const {
+    int order = compare_(key, node->item.first);
+    if(order < 0) {
+        node = unshare(node);
+        node->left = removeHelper(node->left, key);
+        return rebalance(node);
+    }
+    if(order > 0) {
+        node = unshare(node);
+        node->right = removeHelper(node->right, key);
+        return rebalance(node);
+    }
+
+    if(node->left == nullptr || node->right == nullptr) {
+        Node* child = retain(node->left != nullptr ? node->left : node->right);
+        release(node);
+        return child;
+    }
+
+    // Two children: the smallest key of the right subtree takes node's
+    // place.  Keys are const, so it moves into a fresh node, which takes
+    // over node's links.
+    node = unshare(node);
+    Node* min = nullptr;
+    Node* right = removeMin(node->right, min);
+    Node* replacement = new Node(min->item, node->left, right, node->height);
+    node->left = nullptr;
+    node->right = nullptr;
+    release(node);
+    release(min);
+    return rebalance(replacement);
+}
+
+// Removes the smallest node of the subtree, handing back a reference to it
+// in min.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeMin(Node* node, Node*& min) {
+    if(node->left == nullptr) {
+        Node* right = retain(node->right);
+        min = node;
+        return right;
+    }
+    node = unshare(node);
+    node->left = removeMin(node->left, min);
+    return rebalance(node);
+}
+
+/*
+-----------------------------------------------------
+Rotation and rebalance helpers
+-----------------------------------------------------
+*/
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::height(const Node* node) {
+    return (node == nullptr) ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::updateHeight(Node* node) {
+    node->height = static_cast<uint8_t>(std::max(height(node->left), height(node->right)) + 1);
+}
+
+// root is uniquely owned; the child that moves up is unshared first, since
+// its links change too.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node* PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* root) {
+    Node* leftChild = unshare(root->left);
+    root->left = leftChild->right;
+    leftChild->right = root;
+    updateHeight(root);
+    updateHeight(leftChild);
+    return leftChild;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node* PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* root) {
+    Node* rightChild = unshare(root->right);
+    root->right = rightChild->left;
+    rightChild->left = root;
+    updateHeight(root);
+    updateHeight(rightChild);
+    return rightChild;
+}
+
+// Restores the AVL property at a uniquely owned node whose subtrees differ
+// in height by at most two, and returns the subtree's new root.
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node* PersistentAVLTree<Key, Value, Compare>::rebalance(Node* node) {
+    int diff = height(node->left) - height(node->right);
+    if(diff > 1) {
+        if(height(node->left->left) < height(node->left->right))
+            node->left = rotateLeft(unshare(node->left));
+        return rotateRight(node);
+    }
+    if(diff < -1) {
+        if(height(node->right->right) < height(node->right->left))
+            node->right = rotateRight(unshare(node->right));
+        return rotateLeft(node);
+    }
+    updateHeight(node);
+    return node;
+}
+
+/*
+-----------------------------------------------
+End implementations for the PersistentAVLTree class.
+-----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,453 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "bst.h"
+
+/**
+ * A node for a red-black tree.  The color is the low tag bit of the parent
+ * pointer (see Node), so a RedBlackNode is exactly the size of a Node.
+ * New nodes are red.
+ */
+template <typename Key, typename Value>
+class RedBlackNode : public Node<Key, Value>
+{
+public:
+    RedBlackNode(const Key& key, const Value& value, RedBlackNode<Key, Value>* parent);
+    RedBlackNode(ItemFactory<Key, Value>& item, RedBlackNode<Key, Value>* parent);
+    ~RedBlackNode();
+
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Getters for parent, left, and right that hide Node's and return RedBlackNodes.
+    RedBlackNode<Key, Value>* getParent() const;
+    RedBlackNode<Key, Value>* getLeft() const;
+    RedBlackNode<Key, Value>* getRight() const;
+
+protected:
+    static const std::uintptr_t RED = 1;
+};
+
+/*-------------------------------------------------
+  Begin implementations for the RedBlackNode class.
+-------------------------------------------------*/
+template<class Key, class Value>
+RedBlackNode<Key, Value>::RedBlackNode(const Key& key, const Value& value, RedBlackNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent)
+{
+    this->setTag(RED);
+}
+
+template<class Key, class Value>
+RedBlackNode<Key, Value>::RedBlackNode(ItemFactory<Key, Value>& item, RedBlackNode<Key, Value>* parent) :
+    Node<Key, Value>(item, parent)
+{
+    this->setTag(RED);
+}
+
+template<class Key, class Value>
+RedBlackNode<Key, Value>::~RedBlackNode() { }
+
+template<class Key, class Value>
+bool RedBlackNode<Key, Value>::isRed() const {
+    return this->getTag() == RED;
+}
+
+template<class Key, class Value>
+void RedBlackNode<Key, Value>::setRed(bool red) {
+    this->setTag(red ? RED : 0);
+}
+
+template<class Key, class Value>
+RedBlackNode<Key, Value>* RedBlackNode<Key, Value>::getParent() const {
+    return static_cast<RedBlackNode<Key, Value>*>(Node<Key, Value>::getParent());
+}
+
+template<class Key, class Value>
+RedBlackNode<Key, Value>* RedBlackNode<Key, Value>::getLeft() const {
+    return static_cast<RedBlackNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RedBlackNode<Key, Value>* RedBlackNode<Key, Value>::getRight() const {
+    return static_cast<RedBlackNode<Key, Value>*>(this->right_);
+}
+
+/*-------------------------------------------------
+  End implementations for the RedBlackNode class.
+-------------------------------------------------*/
+
+/**
+ * RedBlackTree builds on BinarySearchTree.  It keeps the red-black
+ * invariants (no red node has a red child, and every path from a node down
+ * to an empty child passes the same number of black nodes), which bound
+ * the height by 2 log2(n + 1).  That is looser than AVL's bound, and in
+ * exchange an insertion makes at most two rotations and a removal at most
+ * three; the rest of the fix-up is recoloring.
+ */
+template <class Key, class Value, class Compare = DefaultCompare<Key> >
+class RedBlackTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    RedBlackTree();
+    RedBlackTree(const RedBlackTree& other);    // O(n) structural copy, no rebalancing
+    RedBlackTree(RedBlackTree&& other);
+    RedBlackTree& operator=(RedBlackTree other);
+    virtual void remove(const Key& key) override;
+
+    // Checks the red-black rules rather than BinarySearchTree's height
+    // balance, which a valid red-black tree need not meet.
+    bool isBalanced() const;
+
+protected:
+    // Colors belong to positions in the tree, so nodeSwap swaps them too.
+    virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2) override;
+
+    // Every insertion path in BinarySearchTree creates its node here and
+    // hands it to insertFix once linked.
+    virtual Node<Key, Value>* allocateNode(ItemFactory<Key, Value>& item, Node<Key, Value>* parent) override;
+
+    // Fix-ups after an insertion, and after a removal made the left (or
+    // right) side of parent one black node short.
+    virtual void insertFix(Node<Key, Value>* node) override;
+    void removeFix(RedBlackNode<Key, Value>* parent, bool leftShorter);
+
+    // Rotations relink the rotated subtree into node's old place.
+    void rotateLeft(RedBlackNode<Key, Value>* node);
+    void rotateRight(RedBlackNode<Key, Value>* node);
+    static bool isRedNode(const RedBlackNode<Key, Value>* node);
+    // Black nodes on each path from node down to an empty child, or -1 if
+    // the paths disagree or a red node has a red child.
+    static int blackHeight(const RedBlackNode<Key, Value>* node);
+
+    // buildFromSorted() support: the bottom level is red.
+    virtual Node<Key, Value>* createBuiltNode(ItemFactory<Key, Value>& item,
+                                              std::size_t leftCount, std::size_t rightCount,
+                                              int levelsBelow) override;
+
+    // Copies carry the colors over.
+    virtual Node<Key, Value>* cloneNode(const Node<Key, Value>* source, Node<Key, Value>* parent) override;
+};
+
+/*
+--------------------------------------------
+Begin implementations for the RedBlackTree class.
+--------------------------------------------
+*/
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RedBlackNode<Key, Value>), alignof(RedBlackNode<Key, Value>),
+                                          &BinarySearchTree<Key, Value, Compare>::template destructNode<RedBlackNode<Key, Value> >)
+{
+    static_assert(sizeof(RedBlackNode<Key, Value>) == sizeof(Node<Key, Value>),
+                  "the color must not grow the node");
+}
+
+// Copies from the derived constructor so that cloneNode makes RedBlackNodes.
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(const RedBlackTree& other) :
+    RedBlackTree()
+{
+    static_assert(std::is_copy_constructible<Value>::value, "copying a tree needs a copyable Value");
+    this->cloneFrom(other);
+}
+
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(RedBlackTree&& other) :
+    BinarySearchTree<Key, Value, Compare>(std::move(other))
+{ }
+
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>& RedBlackTree<Key, Value, Compare>::operator=(RedBlackTree other)
+{
+    this->swap(other);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::cloneNode(const Node<Key, Value>* source, Node<Key, Value>* parent)
+{
+    // See BinarySearchTree::cloneNode.
+    if constexpr (std::is_copy_constructible<Value>::value) {
+        const RedBlackNode<Key, Value>* rbSource = static_cast<const RedBlackNode<Key, Value>*>(source);
+        ForwardingItemFactory<Key, Value, const std::pair<const Key, Value>&> item(rbSource->getItem());
+        RedBlackNode<Key, Value>* node = this->template createNode<RedBlackNode<Key, Value> >(
+            item, static_cast<RedBlackNode<Key, Value>*>(parent));
+        node->setRed(rbSource->isRed());
+        return node;
+    }
+    else {
+        (void)source;
+        (void)parent;
+        throw std::logic_error("cloneNode: Value is not copy constructible");
+    }
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::allocateNode(ItemFactory<Key, Value>& item, Node<Key, Value>* parent)
+{
+    return this->template createNode<RedBlackNode<Key, Value> >(item, static_cast<RedBlackNode<Key, Value>*>(parent));
+}
+
+// The new node is red, which can only break the rule against red parents.
+// While its parent is red too: a red uncle means the grandparent's
+// blackness can move down to both its children, pushing the problem two
+// levels up; a black uncle is fixed for good by one or two rotations.
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::insertFix(Node<Key, Value>* inserted)
+{
+    RedBlackNode<Key, Value>* node = static_cast<RedBlackNode<Key, Value>*>(inserted);
+    RedBlackNode<Key, Value>* parent = node->getParent();
+    while(parent != nullptr && parent->isRed()) {
+        RedBlackNode<Key, Value>* grandparent = parent->getParent();
+        if(grandparent == nullptr)
+            break;
+        bool parentIsLeft = (parent == grandparent->getLeft());
+        RedBlackNode<Key, Value>* uncle = parentIsLeft ? grandparent->getRight() : grandparent->getLeft();
+        if(isRedNode(uncle)) {
+            parent->setRed(false);
+            uncle->setRed(false);
+            grandparent->setRed(true);
+            node = grandparent;
+            parent = node->getParent();
+            continue;
+        }
+        if(parentIsLeft) {
+            bool inner = (node == parent->getRight());
+            this->recordRotation(inner);
+            if(inner) {
+                rotateLeft(parent);
+                parent = node;
+            }
+            rotateRight(grandparent);
+        }
+        else {
+            bool inner = (node == parent->getLeft());
+            this->recordRotation(inner);
+            if(inner) {
+                rotateRight(parent);
+                parent = node;
+            }
+            rotateLeft(grandparent);
+        }
+        parent->setRed(false);
+        grandparent->setRed(true);
+        break;
+    }
+    static_cast<RedBlackNode<Key, Value>*>(this->root_)->setRed(false);
+}
+
+/*-------------------------------------------------
+  Implementation for RedBlackTree::remove
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::remove(const Key& key)
+{
+    RedBlackNode<Key, Value>* node = static_cast<RedBlackNode<Key, Value>*>(this->internalFind(key));
+    if(node == nullptr)
+        return;
+
+    // Node with two children: swap with its predecessor so that it has at most one.
+    if(node->getLeft() != nullptr && node->getRight() != nullptr) {
+        Node<Key, Value>* pred = BinarySearchTree<Key, Value, Compare>::predecessor(node);
+        nodeSwap(node, pred);
+    }
+
+    RedBlackNode<Key, Value>* child = (node->getLeft() != nullptr) ? node->getLeft() : node->getRight();
+    RedBlackNode<Key, Value>* parent = node->getParent();
+    bool wasLeft = (parent != nullptr && parent->getLeft() == node);
+    bool wasRed = node->isRed();
+    if(child != nullptr)
+        child->setParent(parent);
+    if(parent == nullptr)
+        this->root_ = child;
+    else if(wasLeft)
+        parent->setLeft(child);
+    else
+        parent->setRight(child);
+    this->destroyNode(node);
+    --this->size_;
+
+    // A red node leaves every path's black count as it was.  A black node
+    // with a child has a red leaf there, which takes over its blackness.
+    if(wasRed)
+        return;
+    if(child != nullptr)
+        child->setRed(false);
+    else
+        removeFix(parent, wasLeft);
+}
+
+// The short side of parent needs one more black node.  A red sibling is
+// rotated up first so that the sibling is black.  If neither of the
+// sibling's children is red, the sibling turns red, which makes parent's
+// whole subtree short instead, and the walk moves up unless parent was red
+// and can simply turn black.  Otherwise one or two rotations move a black
+// node over to the short side and finish.
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::removeFix(RedBlackNode<Key, Value>* parent, bool leftShorter)
+{
+    while(parent != nullptr) {
+        RedBlackNode<Key, Value>* sibling = leftShorter ? parent->getRight() : parent->getLeft();
+        if(sibling->isRed()) {
+            this->recordRotation(false);
+            sibling->setRed(false);
+            parent->setRed(true);
+            if(leftShorter)
+                rotateLeft(parent);
+            else
+                rotateRight(parent);
+            sibling = leftShorter ? parent->getRight() : parent->getLeft();
+        }
+
+        RedBlackNode<Key, Value>* nearNephew = leftShorter ? sibling->getLeft() : sibling->getRight();
+        RedBlackNode<Key, Value>* farNephew = leftShorter ? sibling->getRight() : sibling->getLeft();
+        if(!isRedNode(nearNephew) && !isRedNode(farNephew)) {
+            sibling->setRed(true);
+            if(parent->isRed()) {
+                parent->setRed(false);
+                return;
+            }
+            RedBlackNode<Key, Value>* grandparent = parent->getParent();
+            leftShorter = (grandparent != nullptr && grandparent->getLeft() == parent);
+            parent = grandparent;
+            continue;
+        }
+
+        bool inner = !isRedNode(farNephew);
+        this->recordRotation(inner);
+        if(inner) {
+            nearNephew->setRed(false);
+            sibling->setRed(true);
+            if(leftShorter)
+                rotateRight(sibling);
+            else
+                rotateLeft(sibling);
+            farNephew = sibling;
+            sibling = nearNephew;
+        }
+        sibling->setRed(parent->isRed());
+        parent->setRed(false);
+        farNephew->setRed(false);
+        if(leftShorter)
+            rotateLeft(parent);
+        else
+            rotateRight(parent);
+        return;
+    }
+}
+
+/*-------------------------------------------------
+  Rotations
+  setParent keeps each node's color, so only links change here.
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateLeft(RedBlackNode<Key, Value>* node)
+{
+    RedBlackNode<Key, Value>* rightChild = node->getRight();
+    RedBlackNode<Key, Value>* parent = node->getParent();
+    node->setRight(rightChild->getLeft());
+    if(rightChild->getLeft() != nullptr)
+        rightChild->getLeft()->setParent(node);
+    rightChild->setLeft(node);
+    node->setParent(rightChild);
+    rightChild->setParent(parent);
+    if(parent == nullptr)
+        this->root_ = rightChild;
+    else if(parent->getLeft() == node)
+        parent->setLeft(rightChild);
+    else
+        parent->setRight(rightChild);
+}
+
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateRight(RedBlackNode<Key, Value>* node)
+{
+    RedBlackNode<Key, Value>* leftChild = node->getLeft();
+    RedBlackNode<Key, Value>* parent = node->getParent();
+    node->setLeft(leftChild->getRight());
+    if(leftChild->getRight() != nullptr)
+        leftChild->getRight()->setParent(node);
+    leftChild->setRight(node);
+    node->setParent(leftChild);
+    leftChild->setParent(parent);
+    if(parent == nullptr)
+        this->root_ = leftChild;
+    else if(parent->getLeft() == node)
+        parent->setLeft(leftChild);
+    else
+        parent->setRight(leftChild);
+}
+
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::isBalanced() const
+{
+    return blackHeight(static_cast<RedBlackNode<Key, Value>*>(this->root_)) != -1;
+}
+
+template<class Key, class Value, class Compare>
+int RedBlackTree<Key, Value, Compare>::blackHeight(const RedBlackNode<Key, Value>* node)
+{
+    if(node == nullptr)
+        return 0;
+    if(node->isRed() && (isRedNode(node->getLeft()) || isRedNode(node->getRight())))
+        return -1;
+    int leftHeight = blackHeight(node->getLeft());
+    if(leftHeight == -1)
+        return -1;
+    int rightHeight = blackHeight(node->getRight());
+    if(rightHeight != leftHeight)
+        return -1;
+    return leftHeight + (node->isRed() ? 0 : 1);
+}
+
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::isRedNode(const RedBlackNode<Key, Value>* node)
+{
+    return node != nullptr && node->isRed();
+}
+
+/*-------------------------------------------------
+  Bulk construction support
+  Every empty child of a built tree is on its bottom level or just below,
+  so making the bottom level red and the rest black puts the same number
+  of black nodes on every path.  (The root of a one-item tree is thus red;
+  the fix-ups above allow for that.)
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::createBuiltNode(ItemFactory<Key, Value>& item,
+                                                            std::size_t, std::size_t, int levelsBelow)
+{
+    RedBlackNode<Key, Value>* node = this->template createNode<RedBlackNode<Key, Value> >(item, nullptr);
+    node->setRed(levelsBelow == 0);
+    return node;
+}
+
+/*-------------------------------------------------
+  Override nodeSwap for RedBlackNodes.
+-------------------------------------------------*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+    if(n1 == n2 || n1 == nullptr || n2 == nullptr)
+        return;
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    RedBlackNode<Key, Value>* r1 = static_cast<RedBlackNode<Key, Value>*>(n1);
+    RedBlackNode<Key, Value>* r2 = static_cast<RedBlackNode<Key, Value>*>(n2);
+    bool tempRed = r1->isRed();
+    r1->setRed(r2->isRed());
+    r2->setRed(tempRed);
+}
+
+/*
+------------------------------------------
+End implementations for the RedBlackTree class.
+------------------------------------------
+*/
+
+#endif
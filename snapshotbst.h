@@ -0,0 +1,481 @@
+#ifndef SNAPSHOTBST_H
+#define SNAPSHOTBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * On-disk snapshots of a tree's contents, written by save() and read back by
+ * load() or, without copying, by MappedIndex (mappedindex.h).  Only
+ * standard C++ is used here; the memory mapping needs POSIX and is kept
+ * out of this header.
+ *
+ * A snapshot is a SnapshotHeader followed by the entries in increasing key
+ * order, in one of two layouts:
+ *
+ *  - Fixed: when Key and Value are both trivially copyable, all the keys are
+ *    stored as one array and all the values as another, each in its native
+ *    representation and aligned for its type.  MappedIndex maps such a file
+ *    and binary searches the key array in place.
+ *  - Length-prefixed: otherwise, each entry is its key and then its value,
+ *    each written as a LEB128 length followed by that many bytes from
+ *    SnapshotCodec.
+ *
+ * The header's checksum covers every byte after the header.  Values are
+ * written in the saving machine's byte order and type sizes; the header
+ * records both, so a file from a different machine is rejected instead of
+ * misread.  Trivially copyable types are written as raw bytes, so pointers
+ * inside them are not followed.
+ */
+
+struct SnapshotHeader {
+    char magic[8];              // "BSTSNAP" and a NUL
+    uint32_t byteOrder;         // SNAPSHOT_BYTE_ORDER, as the writer saw it
+    uint32_t layout;            // SNAPSHOT_FIXED or SNAPSHOT_LENGTH_PREFIXED
+    uint32_t keySize;           // sizeof(Key) and sizeof(Value) in the fixed
+    uint32_t valueSize;         // layout, 0 in the length-prefixed one
+    uint64_t count;
+    uint64_t checksum;
+};
+
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+static const uint32_t SNAPSHOT_LENGTH_PREFIXED = 1;
+static const uint32_t SNAPSHOT_FIXED = 2;
+
+/**
+ * How a key or value is turned into bytes in the length-prefixed layout.
+ * Specialize it for other types: encode() appends the bytes for value to
+ * out, and decode() rebuilds a value from the length bytes at data, throwing
+ * std::runtime_error if they are malformed.
+ */
+template<typename T, typename Enable = void>
+struct SnapshotCodec;
+
+template<typename T>
+struct SnapshotCodec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    static void encode(const T& value, std::string& out) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static T decode(const char* data, std::size_t length) {
+        if(length != sizeof(T))
+            throw std::runtime_error("snapshot: field has the wrong length");
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type raw;
+        std::memcpy(&raw, data, sizeof(T));
+        return *reinterpret_cast<T*>(&raw);
+    }
+};
+
+template<>
+struct SnapshotCodec<std::string> {
+    static void encode(const std::string& value, std::string& out) {
+        out.append(value);
+    }
+    static std::string decode(const char* data, std::size_t length) {
+        return std::string(data, length);
+    }
+};
+
+/**
+ * The snapshot checksum: FNV-1a over 64-bit words rather than bytes (with
+ * an extra shift to carry high bits down), so hashing keeps up with the
+ * disk.  Bytes may be fed in pieces of any size.
+ */
+class SnapshotChecksum {
+public:
+    SnapshotChecksum();
+
+    void update(const void* data, std::size_t length);
+    uint64_t value() const;
+
+private:
+    void mix(uint64_t word);
+
+    static const uint64_t OFFSET_BASIS = 14695981039346656037ull;
+    static const uint64_t PRIME = 1099511628211ull;
+
+    uint64_t hash_;
+    unsigned char tail_[8];     // bytes not yet making up a whole word
+    std::size_t tailLength_;
+};
+
+/**
+ * Writes a snapshot to a temporary file beside path and renames it over
+ * path once complete, so a failed save never leaves a torn file behind.
+ * Each writer claims a temporary name of its own, so concurrent saves to
+ * one path each publish a whole file.
+ * Writes are buffered and checksummed as they go; finish() fills in the
+ * header.
+ */
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+    ~SnapshotWriter();
+
+    void write(const void* data, std::size_t length);
+    void writeLength(std::size_t length);       // LEB128
+    void padTo(std::size_t alignment);          // zero bytes up to a multiple
+    void finish(SnapshotHeader header);
+
+private:
+    SnapshotWriter(const SnapshotWriter&);
+    SnapshotWriter& operator=(const SnapshotWriter&);
+
+    void flush();
+    // Creates an empty file beside path under a name no other writer has.
+    static std::string claimTempPath(const std::string& path);
+
+    static const std::size_t BUFFER_BYTES = 1 << 16;
+    static const int TEMP_ATTEMPTS = 100;
+
+    std::string path_;
+    std::string tempPath_;
+    std::ofstream out_;
+    std::string buffer_;
+    std::size_t offset_;        // bytes written so far, header included
+    SnapshotChecksum checksum_;
+    bool finished_;
+};
+
+// Where the arrays of a fixed-layout snapshot start.
+template<typename Key, typename Value>
+struct FixedSnapshotLayout {
+    static std::size_t alignUp(std::size_t offset, std::size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+    static std::size_t keysOffset() {
+        return alignUp(sizeof(SnapshotHeader), alignof(Key));
+    }
+    static std::size_t valuesOffset(std::size_t count) {
+        return alignUp(keysOffset() + count * sizeof(Key), alignof(Value));
+    }
+    static std::size_t fileSize(std::size_t count) {
+        return valuesOffset(count) + count * sizeof(Value);
+    }
+};
+
+template<typename Key, typename Value>
+struct UsesFixedSnapshot : std::integral_constant<bool,
+    std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value> {};
+
+// Writes the count pairs in [first, last), which must be in increasing key
+// order, as a snapshot at path.
+template<typename Key, typename Value, typename ForwardIt>
+void writeSnapshot(const std::string& path, ForwardIt first, ForwardIt last, std::size_t count);
+
+// Reads the pairs of the snapshot at path, in key order.  Throws
+// std::runtime_error if the file cannot be read, was written for other
+// types, fails its checksum, or is not in strictly increasing order under
+// compare (e.g. it was saved by a tree with another order).
+template<typename Key, typename Value, typename Compare>
+std::vector<std::pair<Key, Value> > readSnapshot(const std::string& path, const Compare& compare);
+
+// Checks a header read from a file of fileSize bytes against the types it is
+// about to be read as, throwing std::runtime_error if it does not match.
+template<typename Key, typename Value>
+void checkSnapshotHeader(const SnapshotHeader& header, std::size_t fileSize);
+
+/*
+  --------------------------------------------------
+  Begin implementations for the SnapshotChecksum class.
+  --------------------------------------------------
+*/
+inline SnapshotChecksum::SnapshotChecksum() :
+    hash_(OFFSET_BASIS),
+    tailLength_(0)
+{}
+
+inline void SnapshotChecksum::update(const void* data, std::size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    if(tailLength_ > 0) {
+        std::size_t take = std::min(length, sizeof(tail_) - tailLength_);
+        std::memcpy(tail_ + tailLength_, bytes, take);
+        tailLength_ += take;
+        bytes += take;
+        length -= take;
+        if(tailLength_ < sizeof(tail_))
+            return;
+        uint64_t word;
+        std::memcpy(&word, tail_, sizeof(word));
+        mix(word);
+        tailLength_ = 0;
+    }
+    for(; length >= sizeof(uint64_t); bytes += sizeof(uint64_t), length -= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        mix(word);
+    }
+    std::memcpy(tail_, bytes, length);
+    tailLength_ = length;
+}
+
+inline uint64_t SnapshotChecksum::value() const {
+    uint64_t hash = hash_;
+    for(std::size_t i = 0; i < tailLength_; ++i)
+        hash = (hash ^ tail_[i]) * PRIME;
+    return hash;
+}
+
+inline void SnapshotChecksum::mix(uint64_t word) {
+    hash_ = (hash_ ^ word) * PRIME;
+    hash_ ^= hash_ >> 32;
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the SnapshotChecksum class.
+  ------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the SnapshotWriter class.
+  ------------------------------------------------
+*/
+inline SnapshotWriter::SnapshotWriter(const std::string& path) :
+    path_(path),
+    tempPath_(claimTempPath(path)),
+    out_(tempPath_.c_str(), std::ios::binary | std::ios::trunc),
+    offset_(sizeof(SnapshotHeader)),
+    finished_(false)
+{
+    if(!out_) {
+        std::remove(tempPath_.c_str());
+        throw std::runtime_error("snapshot: cannot create " + tempPath_);
+    }
+    // Leave room for the header, which is only known at the end.
+    SnapshotHeader blank = SnapshotHeader();
+    out_.write(reinterpret_cast<const char*>(&blank), sizeof(blank));
+    buffer_.reserve(BUFFER_BYTES);
+}
+
+// fopen's "x" mode fails if the file exists, so a name is only ever
+// handed to one writer.  The suffix is random per process and counts up
+// within it; a clash just moves on to the next one.
+inline std::string SnapshotWriter::claimTempPath(const std::string& path) {
+    static const unsigned long salt = std::random_device()();
+    static std::atomic<unsigned long> counter(0);
+    for(int attempt = 0; attempt < TEMP_ATTEMPTS; ++attempt) {
+        char suffix[40];
+        std::snprintf(suffix, sizeof(suffix), ".tmp%lx-%lx", salt, counter.fetch_add(1));
+        std::string tempPath = path + suffix;
+        if(std::FILE* file = std::fopen(tempPath.c_str(), "wbx")) {
+            std::fclose(file);
+            return tempPath;
+        }
+    }
+    throw std::runtime_error("snapshot: cannot create a temporary file for " + path);
+}
+
+inline SnapshotWriter::~SnapshotWriter() {
+    if(!finished_) {
+        out_.close();
+        std::remove(tempPath_.c_str());
+    }
+}
+
+inline void SnapshotWriter::write(const void* data, std::size_t length) {
+    buffer_.append(static_cast<const char*>(data), length);
+    offset_ += length;
+    if(buffer_.size() >= BUFFER_BYTES)
+        flush();
+}
+
+inline void SnapshotWriter::writeLength(std::size_t length) {
+    unsigned char bytes[10];
+    std::size_t used = 0;
+    do {
+        unsigned char byte = length & 0x7f;
+        length >>= 7;
+        bytes[used++] = byte | (length != 0 ? 0x80 : 0);
+    } while(length != 0);
+    write(bytes, used);
+}
+
+inline void SnapshotWriter::padTo(std::size_t alignment) {
+    static const char zeros[64] = {};
+    std::size_t padding = (alignment - offset_ % alignment) % alignment;
+    for(; padding > sizeof(zeros); padding -= sizeof(zeros))
+        write(zeros, sizeof(zeros));
+    write(zeros, padding);
+}
+
+inline void SnapshotWriter::flush() {
+    checksum_.update(buffer_.data(), buffer_.size());
+    out_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+inline void SnapshotWriter::finish(SnapshotHeader header) {
+    flush();
+    std::memcpy(header.magic, "BSTSNAP", sizeof(header.magic));
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.checksum = checksum_.value();
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out_.close();
+    if(out_.fail())
+        throw std::runtime_error("snapshot: cannot write " + tempPath_);
+    if(std::rename(tempPath_.c_str(), path_.c_str()) != 0)
+        throw std::runtime_error("snapshot: cannot replace " + path_);
+    finished_ = true;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the SnapshotWriter class.
+  ----------------------------------------------
+*/
+
+/*
+  ------------------------------------------
+  Begin implementations for reading and writing.
+  ------------------------------------------
+*/
+template<typename Key, typename Value, typename ForwardIt>
+void writeSnapshot(const std::string& path, ForwardIt first, ForwardIt last, std::size_t count) {
+    SnapshotWriter writer(path);
+    SnapshotHeader header = SnapshotHeader();
+    header.count = count;
+    if constexpr (UsesFixedSnapshot<Key, Value>::value) {
+        header.layout = SNAPSHOT_FIXED;
+        header.keySize = sizeof(Key);
+        header.valueSize = sizeof(Value);
+        // The values are staged while the keys are written, since walking
+        // a tree a second time costs more than copying them.
+        std::vector<Value> values;
+        values.reserve(count);
+        writer.padTo(alignof(Key));
+        for(ForwardIt it = first; it != last; ++it) {
+            writer.write(&it->first, sizeof(Key));
+            values.push_back(it->second);
+        }
+        writer.padTo(alignof(Value));
+        writer.write(values.data(), values.size() * sizeof(Value));
+    }
+    else {
+        header.layout = SNAPSHOT_LENGTH_PREFIXED;
+        std::string field;
+        for(ForwardIt it = first; it != last; ++it) {
+            field.clear();
+            SnapshotCodec<Key>::encode(it->first, field);
+            writer.writeLength(field.size());
+            writer.write(field.data(), field.size());
+            field.clear();
+            SnapshotCodec<Value>::encode(it->second, field);
+            writer.writeLength(field.size());
+            writer.write(field.data(), field.size());
+        }
+    }
+    writer.finish(header);
+}
+
+template<typename Key, typename Value>
+void checkSnapshotHeader(const SnapshotHeader& header, std::size_t fileSize) {
+    if(std::memcmp(header.magic, "BSTSNAP", sizeof(header.magic)) != 0)
+        throw std::runtime_error("snapshot: not a snapshot file");
+    if(header.byteOrder != SNAPSHOT_BYTE_ORDER)
+        throw std::runtime_error("snapshot: written with another byte order");
+    if(header.layout == SNAPSHOT_FIXED) {
+        if(!UsesFixedSnapshot<Key, Value>::value || header.keySize != sizeof(Key)
+           || header.valueSize != sizeof(Value))
+            throw std::runtime_error("snapshot: written for other key or value types");
+        // Guard the size computation against a count that would overflow it.
+        if(header.count > fileSize
+           || FixedSnapshotLayout<Key, Value>::fileSize(header.count) != fileSize)
+            throw std::runtime_error("snapshot: file is truncated or has trailing data");
+    }
+    else if(header.layout == SNAPSHOT_LENGTH_PREFIXED) {
+        if(UsesFixedSnapshot<Key, Value>::value)
+            throw std::runtime_error("snapshot: written for other key or value types");
+    }
+    else
+        throw std::runtime_error("snapshot: unknown layout");
+}
+
+// Decodes one LEB128 length, advancing pos.
+inline std::size_t readSnapshotLength(const std::string& data, std::size_t& pos) {
+    std::size_t length = 0;
+    for(unsigned shift = 0; pos < data.size() && shift < 64; shift += 7) {
+        unsigned char byte = data[pos++];
+        length |= static_cast<std::size_t>(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0) {
+            if(length > data.size() - pos)
+                break;
+            return length;
+        }
+    }
+    throw std::runtime_error("snapshot: file is truncated or corrupt");
+}
+
+template<typename Key, typename Value, typename Compare>
+std::vector<std::pair<Key, Value> > readSnapshot(const std::string& path, const Compare& compare) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in)
+        throw std::runtime_error("snapshot: cannot open " + path);
+    std::string data;
+    in.seekg(0, std::ios::end);
+    data.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(&data[0], data.size());
+    if(!in || data.size() < sizeof(SnapshotHeader))
+        throw std::runtime_error("snapshot: cannot read " + path);
+
+    SnapshotHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    checkSnapshotHeader<Key, Value>(header, data.size());
+    SnapshotChecksum checksum;
+    checksum.update(data.data() + sizeof(header), data.size() - sizeof(header));
+    if(checksum.value() != header.checksum)
+        throw std::runtime_error("snapshot: checksum mismatch in " + path);
+
+    std::vector<std::pair<Key, Value> > items;
+    if constexpr (UsesFixedSnapshot<Key, Value>::value) {
+        typedef FixedSnapshotLayout<Key, Value> Layout;
+        std::size_t count = header.count;
+        items.reserve(count);
+        const char* keys = data.data() + Layout::keysOffset();
+        const char* values = data.data() + Layout::valuesOffset(count);
+        for(std::size_t i = 0; i < count; ++i) {
+            items.emplace_back(SnapshotCodec<Key>::decode(keys + i * sizeof(Key), sizeof(Key)),
+                               SnapshotCodec<Value>::decode(values + i * sizeof(Value), sizeof(Value)));
+        }
+    }
+    else {
+        std::size_t pos = sizeof(header);
+        for(uint64_t i = 0; i < header.count; ++i) {
+            std::size_t keyLength = readSnapshotLength(data, pos);
+            Key key = SnapshotCodec<Key>::decode(data.data() + pos, keyLength);
+            pos += keyLength;
+            std::size_t valueLength = readSnapshotLength(data, pos);
+            Value value = SnapshotCodec<Value>::decode(data.data() + pos, valueLength);
+            pos += valueLength;
+            items.emplace_back(std::move(key), std::move(value));
+        }
+        if(pos != data.size())
+            throw std::runtime_error("snapshot: file has trailing data");
+    }
+    for(std::size_t i = 1; i < items.size(); ++i) {
+        if(compare(items[i - 1].first, items[i].first) >= 0)
+            throw std::runtime_error("snapshot: keys are not in the tree's order in " + path);
+    }
+    return items;
+}
+
+/*
+  ----------------------------------------
+  End implementations for reading and writing.
+  ----------------------------------------
+*/
+
+#endif
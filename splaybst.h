@@ -0,0 +1,300 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <cstddef>
+#include <utility>
+#include "bst.h"
+
+/**
+ * A self-adjusting search tree.  find(), insert() and remove() splay the
+ * key they look for to the root, top-down in the same pass that searches
+ * for it, so recently used keys stay near root_: under a skewed access
+ * pattern most operations stop after a few levels, and any sequence of
+ * operations costs O(log n) amortized each.  Nodes are plain Nodes, with
+ * no balance data.
+ *
+ * Only the non-const find() splays.  find() on a const tree, the hinted
+ * find(), lower_bound() and the other bounded lookups search without
+ * restructuring; a hinted insert() ignores its hint and splays.  Splaying
+ * only rotates, so iterators stay valid across every call but remove().
+ */
+template <class Key, class Value, class Compare = DefaultCompare<Key> >
+class SplayTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    SplayTree();
+    SplayTree(const SplayTree& other);      // O(n) structural copy
+    SplayTree(SplayTree&& other);
+    SplayTree& operator=(SplayTree other);
+
+    using BinarySearchTree<Key, Value, Compare>::find;
+    typename BinarySearchTree<Key, Value, Compare>::iterator find(const Key& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    typename BinarySearchTree<Key, Value, Compare>::iterator find(const K& key);
+    virtual void remove(const Key& key) override;
+
+protected:
+    // Insertion splays the key to the root; a missing key then becomes the
+    // new root, taking over one side of the old one.
+    virtual Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>*& parent) override;
+    virtual Node<Key, Value>* findSlotNear(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent) override;
+    virtual void linkNode(Node<Key, Value>* node, Node<Key, Value>* parent) override;
+
+    // Splays the subtree at root (which has no parent) around key and
+    // returns its new root: the node with key if there is one (and found is
+    // set), else the last node the search for it reached.
+    template<typename K>
+    Node<Key, Value>* splay(Node<Key, Value>* root, const K& key, bool& found);
+
+    template<typename K>
+    typename BinarySearchTree<Key, Value, Compare>::iterator splayFind(const K& key);
+};
+
+/*
+--------------------------------------------
+Begin implementations for the SplayTree class.
+--------------------------------------------
+*/
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree()
+{ }
+
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree(const SplayTree& other) :
+    BinarySearchTree<Key, Value, Compare>(other)
+{ }
+
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree(SplayTree&& other) :
+    BinarySearchTree<Key, Value, Compare>(std::move(other))
+{ }
+
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>& SplayTree<Key, Value, Compare>::operator=(SplayTree other)
+{
+    this->swap(other);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator SplayTree<Key, Value, Compare>::find(const Key& key)
+{
+    return splayFind(key);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator SplayTree<Key, Value, Compare>::find(const K& key)
+{
+    return splayFind(key);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K>
+typename BinarySearchTree<Key, Value, Compare>::iterator SplayTree<Key, Value, Compare>::splayFind(const K& key)
+{
+    if(this->root_ == nullptr)
+        return this->end();
+    bool found;
+    this->root_ = splay(this->root_, key, found);
+    if(!found)
+        return this->end();
+    return typename BinarySearchTree<Key, Value, Compare>::iterator(this->root_);
+}
+
+// Splays key to the root, then joins the two subtrees under the largest
+// key of the left one, which splaying that subtree brings to its root with
+// no right child.
+template<class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(this->root_ == nullptr)
+        return;
+    bool found;
+    Node<Key, Value>* root = splay(this->root_, key, found);
+    this->root_ = root;
+    if(!found)
+        return;
+
+    Node<Key, Value>* left = root->getLeft();
+    Node<Key, Value>* right = root->getRight();
+    if(left == nullptr)
+        this->root_ = right;
+    else {
+        left->setParent(nullptr);
+        this->root_ = splay(left, key, found);
+        this->root_->setRight(right);
+        if(right != nullptr)
+            right->setParent(this->root_);
+    }
+    if(this->root_ != nullptr)
+        this->root_->setParent(nullptr);
+    this->destroyNode(root);
+    --this->size_;
+}
+
+template<class Key, class Value, class Compare>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::findSlot(const Key& key, Node<Key, Value>*& parent)
+{
+    parent = nullptr;
+    if(this->root_ == nullptr)
+        return nullptr;
+    bool found;
+    this->root_ = splay(this->root_, key, found);
+    if(!found) {
+        parent = this->root_;
+        return nullptr;
+    }
+    return this->root_;
+}
+
+// linkNode needs the key's neighbour at the root, so a hinted insertion
+// splays from the root like any other; the hint is not used.
+template<class Key, class Value, class Compare>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::findSlotNear(Node<Key, Value>*, const Key& key, Node<Key, Value>*& parent)
+{
+    return findSlot(key, parent);
+}
+
+// parent is the splayed root.  Every key on one side of it lies between it
+// and node, so that side moves under node, and the old root becomes node's
+// other child.
+template<class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::linkNode(Node<Key, Value>* node, Node<Key, Value>* parent)
+{
+    node->setParent(nullptr);
+    if(parent != nullptr) {
+        if(this->compare_(node->getKey(), parent->getKey()) < 0) {
+            node->setLeft(parent->getLeft());
+            parent->setLeft(nullptr);
+            node->setRight(parent);
+        }
+        else {
+            node->setRight(parent->getRight());
+            parent->setRight(nullptr);
+            node->setLeft(parent);
+            if(parent == this->rightmost_)
+                this->rightmost_ = node;
+        }
+        if(node->getLeft() != nullptr)
+            node->getLeft()->setParent(node);
+        if(node->getRight() != nullptr)
+            node->getRight()->setParent(node);
+    }
+    else
+        this->rightmost_ = node;
+    this->root_ = node;
+    ++this->size_;
+}
+
+// Top-down splay.  Walking down from root, the nodes passed on the way are
+// split off into two trees: those with keys below key, whose largest node
+// (leftMax) takes each newcomer as its right child, and those above key,
+// whose smallest node (rightMin) takes each as its left child.  Two steps
+// in the same direction rotate first (zig-zig), which is what halves the
+// depth of the path.  At the end the node reached takes the two trees as
+// its children, after handing them its own subtrees.  order always holds
+// the comparison of key with current, so each node is compared once.
+template<class Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::splay(Node<Key, Value>* root, const K& key, bool& found)
+{
+    Node<Key, Value>* leftRoot = nullptr;
+    Node<Key, Value>* leftMax = nullptr;
+    Node<Key, Value>* rightRoot = nullptr;
+    Node<Key, Value>* rightMin = nullptr;
+    Node<Key, Value>* current = root;
+    std::size_t depth = 1;
+    int order = this->compare_(key, current->getKey());
+    while(order != 0) {
+        if(order < 0) {
+            Node<Key, Value>* child = current->getLeft();
+            if(child == nullptr)
+                break;
+            ++depth;
+            order = this->compare_(key, child->getKey());
+            bool rotated = (order < 0);
+            if(rotated) {
+                Node<Key, Value>* inner = child->getRight();
+                current->setLeft(inner);
+                if(inner != nullptr)
+                    inner->setParent(current);
+                child->setRight(current);
+                current->setParent(child);
+                current = child;
+                if(current->getLeft() == nullptr)
+                    break;
+            }
+            if(rightMin == nullptr)
+                rightRoot = current;
+            else {
+                rightMin->setLeft(current);
+                current->setParent(rightMin);
+            }
+            rightMin = current;
+            current = current->getLeft();
+            if(rotated) {
+                ++depth;
+                order = this->compare_(key, current->getKey());
+            }
+        }
+        else {
+            Node<Key, Value>* child = current->getRight();
+            if(child == nullptr)
+                break;
+            ++depth;
+            order = this->compare_(key, child->getKey());
+            bool rotated = (order > 0);
+            if(rotated) {
+                Node<Key, Value>* inner = child->getLeft();
+                current->setRight(inner);
+                if(inner != nullptr)
+                    inner->setParent(current);
+                child->setLeft(current);
+                current->setParent(child);
+                current = child;
+                if(current->getRight() == nullptr)
+                    break;
+            }
+            if(leftMax == nullptr)
+                leftRoot = current;
+            else {
+                leftMax->setRight(current);
+                current->setParent(leftMax);
+            }
+            leftMax = current;
+            current = current->getRight();
+            if(rotated) {
+                ++depth;
+                order = this->compare_(key, current->getKey());
+            }
+        }
+    }
+    found = (order == 0);
+    this->recordSearch(depth, depth);
+
+    if(leftMax != nullptr) {
+        leftMax->setRight(current->getLeft());
+        if(current->getLeft() != nullptr)
+            current->getLeft()->setParent(leftMax);
+        current->setLeft(leftRoot);
+        leftRoot->setParent(current);
+    }
+    if(rightMin != nullptr) {
+        rightMin->setLeft(current->getRight());
+        if(current->getRight() != nullptr)
+            current->getRight()->setParent(rightMin);
+        current->setRight(rightRoot);
+        rightRoot->setParent(current);
+    }
+    current->setParent(nullptr);
+    return current;
+}
+
+/*
+------------------------------------------
+End implementations for the SplayTree class.
+------------------------------------------
+*/
+
+#endif